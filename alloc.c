@@ -0,0 +1,191 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * fixed-size allocation of Sexp nodes.
+ * each process keeps a private free list, refilled from and returned to
+ * a shared pool a batch at a time, so the pool's lock is taken once per Nbatch
+ * operations, not once per node.  the pool is carved from large chunks,
+ * so nodes allocated together by one process lie together in memory.
+ * chunks are never returned to malloc.
+ * a process made by rfork inherits its parent's stack, and with it
+ * the parent's privalloc slot, so each Cache notes the process it belongs to.
+ */
+
+enum{
+	Nbatch=	64,		/* nodes moved between a process and the pool */
+	Nkeep=	2*Nbatch,	/* free nodes a process may hold before returning a batch */
+	Nchunk=	16*Nbatch,	/* nodes obtained from malloc at once */
+};
+
+typedef struct Node Node;
+typedef struct Cache Cache;
+
+struct Node {	/* overlays a free Sexp */
+	Node*	next;	/* in batch or private list */
+	Node*	batch;	/* next batch in pool (first node of batch only) */
+};
+
+struct Cache {	/* per-process */
+	Node*	free;
+	int	nfree;
+	int	pid;	/* its owner */
+};
+
+static struct {
+	Lock;
+	Node*	full;	/* batches of Nbatch free nodes */
+	void**	priv;	/* privalloc'd slot for each process's Cache */
+	Node*	odd;	/* nodes freed without a Cache, until there are Nbatch */
+	int	nodd;
+} pool;
+
+static Cache*
+cache(void)
+{
+	Cache *c;
+	int pid;
+
+	if(pool.priv == nil){
+		lock(&pool);
+		if(pool.priv == nil)
+			pool.priv = privalloc();
+		unlock(&pool);
+	}
+	c = *pool.priv;
+	pid = getpid();
+	if(c == nil || c->pid != pid){	/* none yet, or the parent's */
+		c = mallocz(sizeof(*c), 1);
+		if(c != nil)
+			c->pid = pid;
+		*pool.priv = c;
+	}
+	return c;
+}
+
+/* called with pool locked */
+static int
+carve(void)
+{
+	Node *n, *b;
+	uchar *p;
+	int i, j;
+
+	p = malloc(Nchunk*sizeof(Sexp));
+	if(p == nil)
+		return -1;
+	for(i = 0; i < Nchunk; i += Nbatch){
+		b = nil;
+		for(j = Nbatch; --j >= 0;){
+			n = (Node*)(p + (i+j)*sizeof(Sexp));
+			n->next = b;
+			b = n;
+		}
+		b->batch = pool.full;
+		pool.full = b;
+	}
+	return 0;
+}
+
+static int
+refill(Cache *c)
+{
+	Node *n;
+
+	lock(&pool);
+	if(pool.full == nil && carve() < 0){
+		unlock(&pool);
+		return -1;
+	}
+	n = pool.full;
+	pool.full = n->batch;
+	unlock(&pool);
+	c->free = n;
+	c->nfree = Nbatch;
+	return 0;
+}
+
+Sexp*
+_se_alloc(void)
+{
+	Cache *c;
+	Node *n;
+
+	c = cache();
+	if(c == nil || c->free == nil && refill(c) < 0)
+		return nil;
+	n = c->free;
+	c->free = n->next;
+	c->nfree--;
+	memset(n, 0, sizeof(Sexp));
+	return (Sexp*)n;
+}
+
+/*
+ * allocate up to nv nodes at once, returning the number allocated
+ */
+int
+_se_allocv(Sexp **v, int nv)
+{
+	Cache *c;
+	Node *n;
+	int i;
+
+	c = cache();
+	if(c == nil)
+		return 0;
+	for(i = 0; i < nv; i++){
+		if(c->free == nil && refill(c) < 0)
+			break;
+		n = c->free;
+		c->free = n->next;
+		c->nfree--;
+		memset(n, 0, sizeof(Sexp));
+		v[i] = (Sexp*)n;
+	}
+	return i;
+}
+
+void
+_se_release(Sexp *e)
+{
+	Cache *c;
+	Node *n, *b;
+	int i;
+
+	n = (Node*)e;
+	c = cache();
+	if(c == nil){
+		/* no memory for a Cache: give the node straight back */
+		lock(&pool);
+		n->next = pool.odd;
+		pool.odd = n;
+		if(++pool.nodd == Nbatch){
+			n->batch = pool.full;
+			pool.full = n;
+			pool.odd = nil;
+			pool.nodd = 0;
+		}
+		unlock(&pool);
+		return;
+	}
+	n->next = c->free;
+	c->free = n;
+	if(++c->nfree < Nkeep)
+		return;
+	/* return the most recently freed batch to the pool */
+	b = c->free;
+	n = b;
+	for(i = 1; i < Nbatch; i++)
+		n = n->next;
+	c->free = n->next;
+	c->nfree -= Nbatch;
+	n->next = nil;
+	lock(&pool);
+	b->batch = pool.full;
+	pool.full = b;
+	unlock(&pool);
+}
@@ -0,0 +1,903 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * columnar encoding of many expressions of the same shape.
+ * the atoms that vary between records are stored a column at a time,
+ * each column either dictionary-coded or as lengths then values,
+ * whichever is smaller.
+ *
+ *	batch	"SXB1" nrec ncol tree column*
+ *	tree	'L' n tree*	list of n elements
+ *		'S' hint value	text atom (Sstring)
+ *		'B' hint value	binary atom (Sbinary)
+ *		'V' col	text atom from column col
+ *		'W' col	binary atom from column col
+ *		'A' col	tree from column col
+ *		'X' col tree	the record in column col if not empty, otherwise tree
+ *	hint	1+length then bytes, or 0 for none
+ *	value	length then bytes
+ *	column	nbytes 'p' length[nrec] bytes
+ *		nbytes 'd' ndict (length bytes)[ndict] w index[nrec]
+ *
+ * numbers are unsigned, 7 bits a byte, low-order first, and the top bit set
+ * in every byte but the last; dictionary indices are w bytes, little-endian.
+ * values in 'A' columns are trees without column references.
+ * records whose outer structure differs from the first are kept whole
+ * in an 'X' column, so one odd record doesn't spoil the shape of the rest.
+ */
+
+enum{
+	Kconst,	/* same atom in every record */
+	Kvar,	/* atom, different values */
+	Kany,	/* anything */
+	Klist,	/* list of the same length in every record */
+};
+
+typedef struct Buf Buf;
+typedef struct Col Col;
+typedef struct Shape Shape;
+
+struct Buf {
+	uchar*	p;
+	uint	n;
+	uint	a;
+	int	err;
+};
+
+struct Shape {
+	int	kind;
+	Sexp*	atom;	/* Kconst: the atom; Kvar: one of them */
+	int	mixed;	/* Kvar: tags differ or there are hints */
+	int	n;	/* Klist: elements */
+	Shape*	el;
+	int	col;
+};
+
+struct Col {	/* column being encoded */
+	int	kind;	/* 'V', 'W' or 'A' */
+	Buf	data;
+	uint*	off;	/* offset of each record's value in data */
+};
+
+static void
+bput(Buf *b, void *a, uint n)
+{
+	uchar *p;
+	uint m;
+
+	if(b->err || n == 0)
+		return;
+	if(b->n+n > b->a){
+		m = b->a*2;
+		if(m < b->n+n)
+			m = b->n+n+256;
+		p = realloc(b->p, m);
+		if(p == nil){
+			b->err = 1;
+			return;
+		}
+		b->p = p;
+		b->a = m;
+	}
+	memmove(b->p+b->n, a, n);
+	b->n += n;
+}
+
+static void
+bputc(Buf *b, int c)
+{
+	uchar x;
+
+	x = c;
+	bput(b, &x, 1);
+}
+
+static int
+vlen(uint v)
+{
+	int n;
+
+	for(n = 1; v >= 0x80; v >>= 7)
+		n++;
+	return n;
+}
+
+static void
+bputv(Buf *b, uint v)
+{
+	uchar a[5];
+	int n;
+
+	for(n = 0; v >= 0x80; v >>= 7)
+		a[n++] = v | 0x80;
+	a[n++] = v;
+	bput(b, a, n);
+}
+
+static int
+getv(uchar **pp, uchar *ep, uint *vp)
+{
+	uchar *p;
+	uint v;
+	int s;
+
+	v = 0;
+	for(p = *pp, s = 0; p < ep && s < 32; s += 7){
+		v |= (uint)(*p & 0x7F) << s;
+		if((*p++ & 0x80) == 0){
+			*pp = p;
+			*vp = v;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void
+putatom(Buf *b, Sexp *e)
+{
+	char *p;
+	uint n;
+
+	bputc(b, e->tag == Sstring? 'S': 'B');
+	if(e->hint != nil){
+		bputv(b, 1+s_len(e->hint));
+		bput(b, s_to_c(e->hint), s_len(e->hint));
+	}else
+		bputv(b, 0);
+	p = se_atom(e, &n);
+	bputv(b, n);
+	bput(b, p, n);
+}
+
+/* an expression as a tree without column references */
+static void
+puttree(Buf *b, Sexp *e)
+{
+	Sexp *l;
+
+	if(e->tag != Slist){
+		putatom(b, e);
+		return;
+	}
+	bputc(b, 'L');
+	bputv(b, se_len(e));
+	for(l = se_els(e); l != nil; l = l->tl)
+		puttree(b, l->hd);
+}
+
+/*
+ * shape inference
+ */
+
+static void
+freeshape(Shape *s)
+{
+	int i;
+
+	if(s->kind == Klist){
+		for(i = 0; i < s->n; i++)
+			freeshape(&s->el[i]);
+		free(s->el);
+		s->el = nil;
+	}
+}
+
+static int
+mkshape(Shape *s, Sexp *e)
+{
+	Sexp *l;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	if(e->tag != Slist){
+		s->kind = Kconst;
+		s->atom = e;
+		return 0;
+	}
+	s->kind = Klist;
+	s->el = mallocz((se_len(e)+1)*sizeof(*s->el), 1);
+	if(s->el == nil)
+		return -1;
+	s->n = se_len(e);
+	i = 0;
+	for(l = se_els(e); l != nil; l = l->tl)
+		if(mkshape(&s->el[i++], l->hd) < 0)
+			return -1;
+	return 0;
+}
+
+static void
+any(Shape *s)
+{
+	freeshape(s);
+	s->kind = Kany;
+}
+
+/* e has the same outer structure as a */
+static int
+fits(Sexp *a, Sexp *e)
+{
+	if(a->tag == Slist)
+		return e->tag == Slist && se_len(e) == se_len(a);
+	return e->tag != Slist;
+}
+
+/* widen s to cover e as well */
+static void
+unify(Shape *s, Sexp *e)
+{
+	Sexp *l;
+	int i;
+
+	switch(s->kind){
+	case Kconst:
+		if(e->tag == Slist){
+			any(s);
+			break;
+		}
+		if(se_eq(s->atom, e))
+			break;
+		s->kind = Kvar;
+		/* fall through */
+	case Kvar:
+		if(e->tag == Slist){
+			any(s);
+			break;
+		}
+		if(e->tag != s->atom->tag || e->hint != nil || s->atom->hint != nil)
+			s->mixed = 1;
+		break;
+	case Klist:
+		if(e->tag != Slist || se_len(e) != s->n){
+			any(s);
+			break;
+		}
+		i = 0;
+		for(l = se_els(e); l != nil; l = l->tl)
+			unify(&s->el[i++], l->hd);
+		break;
+	}
+}
+
+/* number the columns, and write the shape */
+static int
+putshape(Buf *b, Shape *s, Col *c, int ncol)
+{
+	int i;
+
+	switch(s->kind){
+	case Kconst:
+		putatom(b, s->atom);
+		break;
+	case Kvar:
+		if(!s->mixed){
+			s->col = ncol;
+			if(c != nil)
+				c[ncol].kind = s->atom->tag == Sstring? 'V': 'W';
+			bputc(b, s->atom->tag == Sstring? 'V': 'W');
+			bputv(b, ncol++);
+			break;
+		}
+		s->kind = Kany;
+		/* fall through */
+	case Kany:
+		s->col = ncol;
+		if(c != nil)
+			c[ncol].kind = 'A';
+		bputc(b, 'A');
+		bputv(b, ncol++);
+		break;
+	case Klist:
+		bputc(b, 'L');
+		bputv(b, s->n);
+		for(i = 0; i < s->n; i++)
+			ncol = putshape(b, &s->el[i], c, ncol);
+		break;
+	}
+	return ncol;
+}
+
+/* append the values of record e to the columns */
+static void
+split(Shape *s, Sexp *e, Col *c, int rec)
+{
+	Col *k;
+	Sexp *l;
+	char *p;
+	uint n;
+	int i;
+
+	switch(s->kind){
+	case Kvar:
+		k = &c[s->col];
+		k->off[rec] = k->data.n;
+		p = se_atom(e, &n);
+		bput(&k->data, p, n);
+		break;
+	case Kany:
+		k = &c[s->col];
+		k->off[rec] = k->data.n;
+		puttree(&k->data, e);
+		break;
+	case Klist:
+		i = 0;
+		for(l = se_els(e); l != nil; l = l->tl)
+			split(&s->el[i++], l->hd, c, rec);
+		break;
+	}
+}
+
+static uint
+hashb(uchar *p, uint n)
+{
+	uint h;
+
+	h = 2166136261U;
+	while(n-- > 0)
+		h = (h ^ *p++) * 16777619;
+	return h;
+}
+
+/* write column c of nrec values, dictionary-coded if that is smaller */
+static void
+putcol(Buf *b, Col *c, int nrec)
+{
+	uint *len, *tab, *id, *first, h, plain, dict, m;
+	int i, j, ndict, w;
+	Buf o;
+
+	c->off[nrec] = c->data.n;
+	len = malloc(nrec*sizeof(*len));
+	m = 1;
+	while(m < 2*nrec)
+		m <<= 1;
+	tab = malloc(m*sizeof(*tab));
+	id = malloc(nrec*sizeof(*id));
+	first = malloc(nrec*sizeof(*first));
+	if(len == nil || tab == nil || id == nil || first == nil){
+		b->err = 1;
+		goto Out;
+	}
+	memset(tab, 0xFF, m*sizeof(*tab));
+	plain = 0;
+	dict = 0;
+	ndict = 0;
+	for(i = 0; i < nrec; i++){
+		len[i] = c->off[i+1] - c->off[i];
+		plain += vlen(len[i]) + len[i];
+		h = hashb(c->data.p+c->off[i], len[i]) & (m-1);
+		for(;; h = (h+1) & (m-1)){
+			j = tab[h];
+			if(j == ~0){
+				tab[h] = i;
+				first[ndict] = i;
+				id[i] = ndict++;
+				dict += vlen(len[i]) + len[i];
+				break;
+			}
+			if(len[j] == len[i] && memcmp(c->data.p+c->off[j], c->data.p+c->off[i], len[i]) == 0){
+				id[i] = id[j];
+				break;
+			}
+		}
+	}
+	w = ndict <= 0x100? 1: ndict <= 0x10000? 2: 4;
+	dict += vlen(ndict) + 1 + nrec*w;
+	memset(&o, 0, sizeof(o));
+	if(dict < plain){
+		bputc(&o, 'd');
+		bputv(&o, ndict);
+		for(i = 0; i < ndict; i++){
+			j = first[i];
+			bputv(&o, len[j]);
+			bput(&o, c->data.p+c->off[j], len[j]);
+		}
+		bputc(&o, w);
+		for(i = 0; i < nrec; i++)
+			for(j = 0; j < w; j++)
+				bputc(&o, id[i]>>(8*j));
+	}else{
+		bputc(&o, 'p');
+		for(i = 0; i < nrec; i++)
+			bputv(&o, len[i]);
+		bput(&o, c->data.p, c->data.n);
+	}
+	if(o.err)
+		b->err = 1;
+	bputv(b, o.n);
+	bput(b, o.p, o.n);
+	free(o.p);
+Out:
+	free(len);
+	free(tab);
+	free(id);
+	free(first);
+}
+
+/*
+ * encode the ne expressions in e as a batch,
+ * returning a buffer allocated by malloc and setting *np to its length
+ */
+uchar*
+se_batch(Sexp **e, int ne, uint *np)
+{
+	Shape shape;
+	Col *c;
+	Buf b, t;
+	uchar *odd;
+	int i, j, ncol, x;
+
+	for(i = 0; i < ne; i++)
+		if(e[i] == nil){
+			werrstr("se_batch: nil expression");
+			return nil;
+		}
+	memset(&b, 0, sizeof(b));
+	memset(&t, 0, sizeof(t));
+	memset(&shape, 0, sizeof(shape));
+	c = nil;
+	ncol = 0;
+	x = 0;
+	shape.kind = Kany;
+	odd = mallocz(ne+1, 1);
+	if(odd == nil)
+		goto Err;
+	if(ne > 0){
+		if(mkshape(&shape, e[0]) < 0)
+			goto Err;
+		for(i = 1; i < ne; i++)
+			if(fits(e[0], e[i]))
+				unify(&shape, e[i]);
+			else
+				x = odd[i] = 1;
+	}
+	/* if x, column 0 holds the records that don't fit */
+	ncol = putshape(&t, &shape, nil, x);
+	c = mallocz((ncol+1)*sizeof(*c), 1);
+	if(c == nil)
+		goto Err;
+	t.n = 0;
+	if(x){
+		bputc(&t, 'X');
+		bputv(&t, 0);
+		c[0].kind = 'A';
+	}
+	putshape(&t, &shape, c, x);
+	for(i = 0; i < ncol; i++){
+		c[i].off = malloc((ne+1)*sizeof(*c[i].off));
+		if(c[i].off == nil)
+			goto Err;
+	}
+	for(i = 0; i < ne; i++){
+		if(odd[i]){
+			for(j = 0; j < ncol; j++)
+				c[j].off[i] = c[j].data.n;
+			puttree(&c[0].data, e[i]);
+			continue;
+		}
+		if(x)
+			c[0].off[i] = c[0].data.n;
+		split(&shape, e[i], c, i);
+	}
+	bput(&b, "SXB1", 4);
+	bputv(&b, ne);
+	bputv(&b, ncol);
+	bput(&b, t.p, t.n);
+	for(i = 0; i < ncol; i++){
+		if(c[i].data.err)
+			b.err = 1;
+		putcol(&b, &c[i], ne);
+	}
+	if(b.err)
+		goto Err;
+	for(i = 0; i < ncol; i++){
+		free(c[i].data.p);
+		free(c[i].off);
+	}
+	free(c);
+	free(t.p);
+	free(odd);
+	freeshape(&shape);
+	*np = b.n;
+	return b.p;
+Err:
+	if(c != nil)
+		for(i = 0; i < ncol; i++){
+			free(c[i].data.p);
+			free(c[i].off);
+		}
+	free(c);
+	free(t.p);
+	free(b.p);
+	free(odd);
+	freeshape(&shape);
+	werrstr("se_batch: out of memory");
+	return nil;
+}
+
+/*
+ * decoding
+ */
+
+typedef struct Dcol Dcol;
+
+struct Dcol {
+	int	kind;	/* 'V', 'W' or 'A' */
+	uchar*	p;	/* body */
+	uchar*	ep;
+	int	ready;
+	int	dict;
+	uint*	off;	/* values, or dictionary entries */
+	uint*	len;
+	int	ndict;
+	int	w;
+	uchar*	idx;
+};
+
+struct Sebatch {
+	Lock;
+	uchar*	shape;
+	uchar*	eshape;
+	int	nrec;
+	int	ncol;
+	Dcol*	col;
+};
+
+static int
+bad(void)
+{
+	werrstr("se_batch: bad format");
+	return -1;
+}
+
+/* check a tree, noting the kinds of the columns it refers to */
+static int
+scantree(Sebatch *b, uchar **pp, uchar *ep, int depth)
+{
+	uchar *p;
+	uint n, v;
+	int c;
+
+	if(depth > 1000 || *pp >= ep)
+		return bad();
+	c = *(*pp)++;
+	switch(c){
+	case 'L':
+		if(getv(pp, ep, &n) < 0)
+			return bad();
+		while(n-- > 0)
+			if(scantree(b, pp, ep, depth+1) < 0)
+				return -1;
+		return 0;
+	case 'S':
+	case 'B':
+		if(getv(pp, ep, &n) < 0)
+			return bad();
+		if(n > 0){
+			p = *pp;
+			if(ep-p < n-1)
+				return bad();
+			*pp = p+n-1;
+		}
+		if(getv(pp, ep, &n) < 0 || ep-*pp < n)
+			return bad();
+		*pp += n;
+		return 0;
+	case 'V':
+	case 'W':
+	case 'A':
+		if(b == nil || getv(pp, ep, &v) < 0 || v >= b->ncol)
+			return bad();
+		b->col[v].kind = c;
+		return 0;
+	case 'X':
+		if(b == nil || depth > 0 || getv(pp, ep, &v) < 0 || v >= b->ncol)
+			return bad();
+		b->col[v].kind = 'A';
+		return scantree(b, pp, ep, depth+1);
+	}
+	return bad();
+}
+
+Sebatch*
+se_batchopen(uchar *buf, uint n)
+{
+	Sebatch *b;
+	uchar *p, *ep;
+	uint nrec, ncol, m;
+	int i;
+
+	p = buf;
+	ep = buf+n;
+	if(n < 4 || memcmp(p, "SXB1", 4) != 0){
+		werrstr("se_batchopen: not a batch");
+		return nil;
+	}
+	p += 4;
+	if(getv(&p, ep, &nrec) < 0 || getv(&p, ep, &ncol) < 0 || nrec > 0x7FFFFFFF || ncol > n){
+		bad();
+		return nil;
+	}
+	b = mallocz(sizeof(*b), 1);
+	if(b == nil)
+		return nil;
+	b->nrec = nrec;
+	b->ncol = ncol;
+	b->col = mallocz((ncol+1)*sizeof(*b->col), 1);
+	if(b->col == nil){
+		free(b);
+		return nil;
+	}
+	b->shape = p;
+	if(scantree(b, &p, ep, 0) < 0)
+		goto Err;
+	b->eshape = p;
+	for(i = 0; i < ncol; i++){
+		if(b->col[i].kind == 0 || getv(&p, ep, &m) < 0 || ep-p < m || m == 0){
+			bad();
+			goto Err;
+		}
+		b->col[i].p = p;
+		b->col[i].ep = p+m;
+		p += m;
+	}
+	return b;
+Err:
+	free(b->col);
+	free(b);
+	return nil;
+}
+
+void
+se_batchclose(Sebatch *b)
+{
+	int i;
+
+	if(b == nil)
+		return;
+	for(i = 0; i < b->ncol; i++){
+		free(b->col[i].off);
+		free(b->col[i].len);
+	}
+	free(b->col);
+	free(b);
+}
+
+int
+se_batchlen(Sebatch *b)
+{
+	return b->nrec;
+}
+
+/* find the values of column c, the first time it is used */
+static int
+colinit(Sebatch *b, Dcol *c)
+{
+	uchar *p;
+	uint i, n, v;
+
+	p = c->p;
+	if(*p == 'd'){
+		c->dict = 1;
+		p++;
+		if(getv(&p, c->ep, &n) < 0 || n > c->ep-p)
+			return bad();
+		c->ndict = n;
+	}else if(*p == 'p'){
+		p++;
+		n = b->nrec;
+	}else
+		return bad();
+	c->off = malloc((n+1)*sizeof(*c->off));
+	c->len = malloc((n+1)*sizeof(*c->len));
+	if(c->off == nil || c->len == nil)
+		return -1;
+	if(c->dict){
+		for(i = 0; i < n; i++){
+			if(getv(&p, c->ep, &v) < 0 || c->ep-p < v)
+				return bad();
+			c->off[i] = p - c->p;
+			c->len[i] = v;
+			p += v;
+		}
+		if(p >= c->ep)
+			return bad();
+		c->w = *p++;
+		if(c->w != 1 && c->w != 2 && c->w != 4 || c->ep-p < (vlong)b->nrec*c->w)
+			return bad();
+		c->idx = p;
+	}else{
+		for(i = 0; i < n; i++)
+			if(getv(&p, c->ep, &c->len[i]) < 0)
+				return bad();
+		v = p - c->p;
+		for(i = 0; i < n; i++){
+			c->off[i] = v;
+			v += c->len[i];
+			if(v > c->ep - c->p)
+				return bad();
+		}
+	}
+	coherence();
+	c->ready = 1;
+	return 0;
+}
+
+/* the value in column col of record rec */
+static uchar*
+value(Sebatch *b, int col, int rec, uint *np)
+{
+	Dcol *c;
+	uchar *q;
+	uint k;
+	int i, r;
+
+	if(col < 0 || col >= b->ncol || rec < 0 || rec >= b->nrec){
+		werrstr("se_batch: no such value");
+		return nil;
+	}
+	c = &b->col[col];
+	if(!c->ready){
+		lock(b);
+		r = 0;
+		if(!c->ready){
+			free(c->off);
+			free(c->len);
+			r = colinit(b, c);
+		}
+		unlock(b);
+		if(r < 0)
+			return nil;
+	}
+	if(c->dict){
+		q = c->idx + rec*c->w;
+		k = 0;
+		for(i = c->w; --i >= 0;)
+			k = k<<8 | q[i];
+		if(k >= c->ndict){
+			bad();
+			return nil;
+		}
+	}else
+		k = rec;
+	*np = c->len[k];
+	return c->p + c->off[k];
+}
+
+/*
+ * the raw value of text or binary atom column col in record rec,
+ * without decoding the record
+ */
+char*
+se_batchval(Sebatch *b, int col, int rec, uint *np)
+{
+	if(col >= 0 && col < b->ncol && b->col[col].kind == 'A'){
+		werrstr("se_batchval: not an atom column");
+		return nil;
+	}
+	return (char*)value(b, col, rec, np);
+}
+
+/*
+ * decode a tree, taking column values from record rec,
+ * or showing the columns if rec is negative.
+ * b is nil in a column value, which can't refer to columns
+ */
+static Sexp*
+dectree(Sebatch *b, uchar **pp, uchar *ep, int rec, int depth)
+{
+	Sexp *e, *l, *x;
+	String *h;
+	uchar *p;
+	uint n, v;
+	int c;
+
+	if(*pp >= ep || depth > 1000){
+		bad();
+		return nil;
+	}
+	c = *(*pp)++;
+	switch(c){
+	case 'L':
+		if(getv(pp, ep, &n) < 0){
+			bad();
+			return nil;
+		}
+		e = se_cons(nil, nil);
+		for(l = e; n-- > 0;){
+			x = dectree(b, pp, ep, rec, depth+1);
+			if(x == nil){
+				se_free(e);
+				return nil;
+			}
+			if(l->hd != nil)
+				l = l->tl = se_cons(nil, nil);
+			l->hd = x;
+		}
+		return e;
+	case 'S':
+	case 'B':
+		h = nil;
+		if(getv(pp, ep, &n) < 0)
+			goto Bad;
+		if(n > 0){
+			if(ep-*pp < n-1)
+				goto Bad;
+			h = s_newalloc(n);
+			s_memappend(h, (char*)*pp, n-1);
+			s_terminate(h);
+			*pp += n-1;
+		}
+		if(getv(pp, ep, &n) < 0 || ep-*pp < n){
+			s_free(h);
+			goto Bad;
+		}
+		p = *pp;
+		*pp += n;
+		return _se_mkatom(c == 'S'? Sstring: Sbinary, p, n, h);
+	case 'V':
+	case 'W':
+	case 'A':
+		if(b == nil || getv(pp, ep, &v) < 0 || v >= b->ncol)
+			goto Bad;
+		if(rec < 0){	/* shape only */
+			e = se_vlong(v);
+			e->hint = s_copy("col");
+			return e;
+		}
+		p = value(b, v, rec, &n);
+		if(p == nil)
+			return nil;
+		if(c == 'A')
+			return dectree(nil, &p, p+n, rec, 0);
+		return _se_mkatom(c == 'V'? Sstring: Sbinary, p, n, nil);
+	case 'X':
+		if(b == nil || getv(pp, ep, &v) < 0 || v >= b->ncol)
+			goto Bad;
+		if(rec >= 0){
+			p = value(b, v, rec, &n);
+			if(p == nil)
+				return nil;
+			if(n > 0)
+				return dectree(nil, &p, p+n, rec, 0);
+		}
+		return dectree(b, pp, ep, rec, depth+1);
+	}
+Bad:
+	bad();
+	return nil;
+}
+
+/*
+ * record rec of the batch
+ */
+Sexp*
+se_batchget(Sebatch *b, int rec)
+{
+	uchar *p;
+
+	if(rec < 0 || rec >= b->nrec){
+		werrstr("se_batchget: no such record");
+		return nil;
+	}
+	p = b->shape;
+	return dectree(b, &p, b->eshape, rec, 0);
+}
+
+/*
+ * the common shape of the records,
+ * with each column shown as an atom [col]n
+ */
+Sexp*
+se_batchshape(Sebatch *b)
+{
+	uchar *p;
+
+	p = b->shape;
+	return dectree(b, &p, b->eshape, -1, 0);
+}
@@ -0,0 +1,299 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * build a tree an element at a time, appending to the innermost open list.
+ * list cells are taken from the allocator a batch at a time,
+ * and atom buffers are adopted, not copied, unless small enough to keep in the node.
+ * a nil builder, from se_builder out of memory, is accepted by everything, and fails.
+ */
+
+enum{
+	Ncell=	32,	/* cells reserved at once */
+};
+
+typedef struct Level Level;
+
+struct Level {
+	Sexp*	list;
+	Sexp*	last;	/* last cell of list */
+};
+
+struct Sebuild {
+	Level*	stk;	/* stk[0] holds the result */
+	int	nstk;
+	int	astk;
+	Sexp*	cell[Ncell];	/* reserved cells */
+	int	ncell;
+	char*	err;
+};
+
+Sebuild*
+se_builder(void)
+{
+	Sebuild *b;
+
+	b = mallocz(sizeof(*b), 1);
+	if(b == nil)
+		return nil;
+	b->astk = 8;
+	b->stk = mallocz(b->astk*sizeof(*b->stk), 1);
+	if(b->stk == nil){
+		free(b);
+		return nil;
+	}
+	b->nstk = 1;
+	return b;
+}
+
+static int
+nobuilder(void)
+{
+	werrstr("se_builder: out of memory");
+	return -1;
+}
+
+static Sexp*
+newcell(Sebuild *b)
+{
+	Sexp *e;
+
+	if(b->ncell == 0){
+		b->ncell = _se_allocv(b->cell, Ncell);
+		if(b->ncell == 0)
+			return nil;
+	}
+	e = b->cell[--b->ncell];
+	e->inuse = 1;
+	e->tag = Slist;
+	return e;
+}
+
+static int
+fail(Sebuild *b, char *err)
+{
+	if(b->err == nil)
+		b->err = err;
+	return -1;
+}
+
+/* append e to the innermost open list, or make it the result */
+static int
+append(Sebuild *b, Sexp *e)
+{
+	Level *l;
+	Sexp *c;
+
+	l = &b->stk[b->nstk-1];
+	if(b->nstk == 1){
+		if(l->list != nil){
+			se_free(e);
+			return fail(b, "more than one expression");
+		}
+		l->list = e;
+		return 0;
+	}
+	if(l->last->hd == nil){
+		l->last->hd = e;
+		return 0;
+	}
+	c = newcell(b);
+	if(c == nil){
+		se_free(e);
+		return fail(b, "out of memory");
+	}
+	c->hd = e;
+	l->last->tl = c;
+	l->last = c;
+	return 0;
+}
+
+/*
+ * append e, which now belongs to the builder
+ */
+int
+se_push(Sebuild *b, Sexp *e)
+{
+	if(b == nil){
+		se_free(e);
+		return nobuilder();
+	}
+	if(b->err != nil){
+		se_free(e);
+		return -1;
+	}
+	if(e == nil)
+		return fail(b, "nil expression");
+	return append(b, e);
+}
+
+static int
+pushsmall(Sebuild *b, int tag, void *a, uint n)
+{
+	Sexp *e;
+
+	e = _se_alloc();
+	if(e == nil){
+		free(a);
+		return fail(b, "out of memory");
+	}
+	e->inuse = 1;
+	e->tag = tag;
+	memmove(e->inl, a, n);
+	e->inl[n] = 0;
+	e->ninl = n;
+	free(a);
+	return append(b, e);
+}
+
+static int
+pushatom(Sebuild *b, int tag, String *s)
+{
+	Sexp *e;
+
+	if(s == nil)
+		return fail(b, "out of memory");
+	e = _se_alloc();
+	if(e == nil){
+		s_free(s);
+		return fail(b, "out of memory");
+	}
+	e->inuse = 1;
+	e->tag = tag;
+	e->s = s;
+	return append(b, e);
+}
+
+/*
+ * append a text atom whose value is the null-terminated s,
+ * which must have been allocated by malloc, and now belongs to the builder
+ */
+int
+se_pushstr(Sebuild *b, char *s)
+{
+	String *t;
+	uint n;
+
+	if(b == nil){
+		free(s);
+		return nobuilder();
+	}
+	if(b->err != nil){
+		free(s);
+		return -1;
+	}
+	n = strlen(s);
+	if(n < Ninline)
+		return pushsmall(b, Sstring, s, n);
+	t = _b_new(s, n);
+	if(t == nil){
+		free(s);
+		return fail(b, "out of memory");
+	}
+	t->end++;	/* include the null byte */
+	return pushatom(b, Sstring, t);
+}
+
+/*
+ * append a binary atom whose value is the n bytes at a,
+ * which must have been allocated by malloc, and now belongs to the builder
+ */
+int
+se_pushdata(Sebuild *b, uchar *a, uint n)
+{
+	String *t;
+
+	if(b == nil){
+		free(a);
+		return nobuilder();
+	}
+	if(b->err != nil){
+		free(a);
+		return -1;
+	}
+	if(n < Ninline)
+		return pushsmall(b, Sbinary, a, n);
+	t = _b_new(a, n);
+	if(t == nil){
+		free(a);
+		return fail(b, "out of memory");
+	}
+	return pushatom(b, Sbinary, t);
+}
+
+/*
+ * start a list, which receives subsequent elements until se_close
+ */
+int
+se_open(Sebuild *b)
+{
+	Level *l;
+	Sexp *c;
+
+	if(b == nil)
+		return nobuilder();
+	if(b->err != nil)
+		return -1;
+	if(b->nstk == b->astk){
+		l = realloc(b->stk, 2*b->astk*sizeof(*l));
+		if(l == nil)
+			return fail(b, "out of memory");
+		b->stk = l;
+		b->astk *= 2;
+	}
+	c = newcell(b);
+	if(c == nil)
+		return fail(b, "out of memory");
+	l = &b->stk[b->nstk++];
+	l->list = c;
+	l->last = c;
+	return 0;
+}
+
+int
+se_close(Sebuild *b)
+{
+	if(b == nil)
+		return nobuilder();
+	if(b->err != nil)
+		return -1;
+	if(b->nstk == 1)
+		return fail(b, "se_close without se_open");
+	b->nstk--;
+	return append(b, b->stk[b->nstk].list);
+}
+
+/*
+ * return the expression built, and free the builder
+ */
+Sexp*
+se_finish(Sebuild *b)
+{
+	Sexp *e;
+	int i;
+
+	if(b == nil){
+		nobuilder();
+		return nil;
+	}
+	if(b->nstk > 1){
+		fail(b, "unclosed list");
+		for(i = 1; i < b->nstk; i++)
+			se_free(b->stk[i].list);
+	}
+	e = b->stk[0].list;
+	if(b->err != nil){
+		werrstr("se_finish: %s", b->err);
+		se_free(e);
+		e = nil;
+	}else if(e == nil)
+		werrstr("se_finish: no expression");
+	for(i = 0; i < b->ncell; i++)
+		_se_release(b->cell[i]);
+	free(b->stk);
+	free(b);
+	return e;
+}
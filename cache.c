@@ -0,0 +1,267 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * trees parsed from byte strings, kept by content:
+ * a hash table of entries on an LRU list, bounded in bytes.
+ * a hit is confirmed by comparing the input with a copy kept in the entry,
+ * and returns another reference to the same tree.
+ */
+
+enum{
+	Ntab=	64,	/* initial hash buckets */
+};
+
+typedef struct Entry Entry;
+
+struct Entry {
+	Entry*	hnext;	/* in bucket */
+	Entry*	prev;	/* in LRU list */
+	Entry*	next;
+	uvlong	h;
+	uchar*	key;	/* copy of the input */
+	uint	n;
+	uint	used;	/* bytes of input parsed */
+	Sexp*	e;
+	vlong	size;	/* charged against the bound */
+};
+
+struct Secache {
+	Lock;
+	Entry**	tab;
+	int	ntab;
+	Entry	lru;	/* next is most recently used, prev least */
+	vlong	max;
+	Secachestat	stat;
+};
+
+static uvlong
+hash(uchar *p, uint n)
+{
+	uvlong h, w;
+	uchar *ep;
+
+	h = 0xcbf29ce484222325ULL ^ n;
+	for(ep = p + (n & ~7); p < ep; p += 8){
+		memmove(&w, p, 8);
+		h = (h ^ w) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	for(ep = p + (n & 7); p < ep; p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+	return h ^ h >> 32;
+}
+
+static int
+charge(Sexp *e, void *a)
+{
+	vlong *sz;
+
+	sz = a;
+	*sz += 2*sizeof(Sexp);	/* the node, and the cell holding it */
+	if(e->tag != Slist){
+		if(e->s != nil)
+			*sz += s_len(e->s);
+		if(e->hint != nil)
+			*sz += s_len(e->hint);
+	}
+	return 0;
+}
+
+/*
+ * a cache holding up to max bytes of input and trees
+ */
+Secache*
+se_cacheopen(vlong max)
+{
+	Secache *c;
+
+	c = mallocz(sizeof(*c), 1);
+	if(c == nil)
+		return nil;
+	c->ntab = Ntab;
+	c->tab = mallocz(c->ntab*sizeof(*c->tab), 1);
+	if(c->tab == nil){
+		free(c);
+		return nil;
+	}
+	c->lru.next = c->lru.prev = &c->lru;
+	c->max = max;
+	return c;
+}
+
+static void
+lruout(Entry *x)
+{
+	x->prev->next = x->next;
+	x->next->prev = x->prev;
+}
+
+static void
+lruin(Secache *c, Entry *x)
+{
+	x->next = c->lru.next;
+	x->prev = &c->lru;
+	x->next->prev = x;
+	c->lru.next = x;
+}
+
+/* called with c locked */
+static void
+drop(Secache *c, Entry *x)
+{
+	Entry **l;
+
+	for(l = &c->tab[x->h & (c->ntab-1)]; *l != x; l = &(*l)->hnext)
+		{}
+	*l = x->hnext;
+	lruout(x);
+	c->stat.bytes -= x->size;
+	c->stat.entries--;
+	se_free(x->e);
+	free(x->key);
+	free(x);
+}
+
+/* called with c locked */
+static void
+grow(Secache *c)
+{
+	Entry **t, *x, *nx;
+	int i, n;
+
+	n = 2*c->ntab;
+	t = mallocz(n*sizeof(*t), 1);
+	if(t == nil)
+		return;	/* longer chains will do */
+	for(i = 0; i < c->ntab; i++)
+		for(x = c->tab[i]; x != nil; x = nx){
+			nx = x->hnext;
+			x->hnext = t[x->h & (n-1)];
+			t[x->h & (n-1)] = x;
+		}
+	free(c->tab);
+	c->tab = t;
+	c->ntab = n;
+}
+
+/* called with c locked */
+static Entry*
+lookup(Secache *c, uvlong h, uchar *a, uint n)
+{
+	Entry *x;
+
+	for(x = c->tab[h & (c->ntab-1)]; x != nil; x = x->hnext)
+		if(x->h == h && x->n == n && memcmp(x->key, a, n) == 0)
+			return x;
+	return nil;
+}
+
+/*
+ * se_unpack, but a tree already made from the same asize bytes is shared, not parsed again.
+ * the result must not be changed in place (se_patch copies what it changes).
+ */
+Sexp*
+se_cacheunpack(Secache *c, char *a, uint asize, char **ep)
+{
+	Entry *x;
+	Sexp *e;
+	uvlong h;
+	char *end;
+	vlong size;
+
+	h = hash((uchar*)a, asize);
+	lock(c);
+	x = lookup(c, h, (uchar*)a, asize);
+	if(x != nil){
+		lruout(x);
+		lruin(c, x);
+		c->stat.hits++;
+		e = se_incref(x->e);
+		if(ep != nil)
+			*ep = a + x->used;
+		unlock(c);
+		return e;
+	}
+	c->stat.misses++;
+	unlock(c);
+
+	e = se_unpack(a, asize, &end);
+	if(ep != nil)
+		*ep = end;
+	if(e == nil)
+		return nil;
+	size = sizeof(*x) + asize;
+	se_walk(e, charge, nil, &size);
+	if(size > c->max)
+		return e;
+	x = mallocz(sizeof(*x), 1);
+	if(x == nil)
+		return e;
+	x->key = malloc(asize+1);
+	if(x->key == nil){
+		free(x);
+		return e;
+	}
+	memmove(x->key, a, asize);
+	x->n = asize;
+	x->h = h;
+	x->used = end - a;
+	x->size = size;
+	x->e = se_incref(e);
+
+	lock(c);
+	if(lookup(c, h, (uchar*)a, asize) != nil){	/* parsed meanwhile by another process */
+		unlock(c);
+		se_free(x->e);
+		free(x->key);
+		free(x);
+		return e;
+	}
+	while(c->stat.bytes + size > c->max && c->lru.prev != &c->lru){
+		drop(c, c->lru.prev);
+		c->stat.evictions++;
+	}
+	if(c->stat.entries >= c->ntab)
+		grow(c);
+	x->hnext = c->tab[h & (c->ntab-1)];
+	c->tab[h & (c->ntab-1)] = x;
+	lruin(c, x);
+	c->stat.bytes += size;
+	c->stat.entries++;
+	unlock(c);
+	return e;
+}
+
+Sexp*
+se_cacheparse(Secache *c, char *s, char **ep)
+{
+	return se_cacheunpack(c, s, strlen(s), ep);
+}
+
+void
+se_cachestat(Secache *c, Secachestat *st)
+{
+	lock(c);
+	*st = c->stat;
+	unlock(c);
+}
+
+/*
+ * release the cache's references to its trees, which remain valid for other holders
+ */
+void
+se_cacheclose(Secache *c)
+{
+	if(c == nil)
+		return;
+	lock(c);
+	while(c->lru.next != &c->lru)
+		drop(c, c->lru.next);
+	unlock(c);
+	free(c->tab);
+	free(c);
+}
@@ -0,0 +1,556 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * a collection of trees, indexed by the atoms they contain at given paths.
+ * the path of an atom is the sequence of operators of the lists enclosing it,
+ * from the root down, joined by '/': in (cert (issuer (hash md5 |...|)) ...),
+ * md5 and the hash value are at cert/issuer/hash.
+ * each (path, value) key has the ids of the members holding it, in ascending order;
+ * ids are given out in order, and a removed member's id is dropped
+ * from the lists only when enough have accumulated to renumber them all.
+ */
+
+enum{
+	Ntab=	64,	/* initial hash buckets */
+	Mindead=	64,	/* removed members worth renumbering for */
+};
+
+typedef struct Key Key;
+typedef struct Memb Memb;
+typedef struct Path Path;
+
+struct Path {	/* a path indexed, or a prefix of one */
+	Path*	next;
+	uint	h;
+	char*	s;
+	int	n;
+	int	id;
+	int	indexed;
+};
+
+struct Key {
+	Key*	next;
+	uint	h;
+	int	path;
+	uchar*	val;
+	uint	len;
+	long*	id;	/* members, ascending */
+	long	n;
+	long	a;
+};
+
+struct Memb {
+	Memb*	next;	/* in bucket, by tree */
+	uint	h;
+	Sexp*	e;
+	long	id;
+};
+
+struct Secoll {
+	Lock;
+	int	all;	/* index every path */
+	Path**	ptab;
+	int	nptab;
+	int	npath;
+	Key**	ktab;
+	long	nktab;
+	long	nkey;
+	Memb**	mtab;
+	long	nmtab;
+	Memb**	memb;	/* by id, or nil once removed */
+	long	nid;
+	long	amemb;
+	long	nlive;
+};
+
+static uint
+hash(void *a, uint n)
+{
+	uchar *p, *ep;
+	uint h;
+
+	h = 2166136261U;
+	for(p = a, ep = p+n; p < ep; p++)
+		h = (h ^ *p) * 16777619;
+	return h;
+}
+
+static uint
+ptrhash(Sexp *e)
+{
+	return ((uintptr)e >> 4) * 2654435761U;
+}
+
+/* rehash a table of n buckets, each entry having next and h, into twice as many */
+#define	GROW(T, tab, n) {\
+	T **t, *x, *nx;\
+	long i;\
+	t = mallocz(2*(n)*sizeof(*t), 1);\
+	if(t != nil){\
+		for(i = 0; i < (n); i++)\
+			for(x = (tab)[i]; x != nil; x = nx){\
+				nx = x->next;\
+				x->next = t[x->h & (2*(n)-1)];\
+				t[x->h & (2*(n)-1)] = x;\
+			}\
+		free(tab);\
+		(tab) = t;\
+		(n) *= 2;\
+	}\
+}
+
+static Path*
+path(Secoll *c, char *s, int n, int make)
+{
+	Path *p;
+	uint h;
+
+	h = hash(s, n);
+	for(p = c->ptab[h & (c->nptab-1)]; p != nil; p = p->next)
+		if(p->h == h && p->n == n && memcmp(p->s, s, n) == 0)
+			return p;
+	if(!make)
+		return nil;
+	p = mallocz(sizeof(*p)+n+1, 1);
+	if(p == nil)
+		return nil;
+	p->s = (char*)(p+1);
+	memmove(p->s, s, n);
+	p->n = n;
+	p->h = h;
+	p->id = c->npath++;
+	p->next = c->ptab[h & (c->nptab-1)];
+	c->ptab[h & (c->nptab-1)] = p;
+	if(c->npath >= c->nptab)
+		GROW(Path, c->ptab, c->nptab);
+	return p;
+}
+
+static Key*
+key(Secoll *c, int pid, void *v, uint n, int make)
+{
+	Key *k;
+	uint h;
+
+	h = hash(v, n) ^ pid*0x9e3779b9;
+	for(k = c->ktab[h & (c->nktab-1)]; k != nil; k = k->next)
+		if(k->h == h && k->path == pid && k->len == n && memcmp(k->val, v, n) == 0)
+			return k;
+	if(!make)
+		return nil;
+	k = mallocz(sizeof(*k)+n, 1);
+	if(k == nil)
+		return nil;
+	k->val = (uchar*)(k+1);
+	memmove(k->val, v, n);
+	k->len = n;
+	k->path = pid;
+	k->h = h;
+	k->next = c->ktab[h & (c->nktab-1)];
+	c->ktab[h & (c->nktab-1)] = k;
+	if(++c->nkey >= c->nktab)
+		GROW(Key, c->ktab, c->nktab);
+	return k;
+}
+
+static Memb**
+memb(Secoll *c, Sexp *e)
+{
+	Memb **l;
+
+	for(l = &c->mtab[ptrhash(e) & (c->nmtab-1)]; *l != nil; l = &(*l)->next)
+		if((*l)->e == e)
+			break;
+	return l;
+}
+
+/*
+ * a collection indexing the atoms at each of the nil-terminated paths,
+ * or at every path if paths is nil
+ */
+Secoll*
+se_collopen(char **paths)
+{
+	Secoll *c;
+	Path *p;
+	char *s;
+	int n;
+
+	c = mallocz(sizeof(*c), 1);
+	if(c == nil)
+		return nil;
+	c->nptab = c->nktab = c->nmtab = Ntab;
+	c->ptab = mallocz(Ntab*sizeof(*c->ptab), 1);
+	c->ktab = mallocz(Ntab*sizeof(*c->ktab), 1);
+	c->mtab = mallocz(Ntab*sizeof(*c->mtab), 1);
+	if(c->ptab == nil || c->ktab == nil || c->mtab == nil){
+		se_collclose(c);
+		return nil;
+	}
+	c->all = paths == nil;
+	for(; paths != nil && *paths != nil; paths++){
+		s = *paths;
+		n = strlen(s);
+		p = path(c, s, n, 1);
+		if(p == nil){
+			se_collclose(c);
+			return nil;
+		}
+		p->indexed = 1;
+		while(--n > 0)	/* the prefixes lead to it */
+			if(s[n] == '/' && path(c, s, n, 1) == nil){
+				se_collclose(c);
+				return nil;
+			}
+	}
+	return c;
+}
+
+static int
+add(Secoll *c, int pid, Sexp *a, long id)
+{
+	Key *k;
+	long *ids;
+	char *v;
+	uint n;
+
+	if(a->aflag & Abig)
+		return 0;	/* not worth reading in */
+	v = se_atom(a, &n);
+	if(v == nil)
+		return -1;
+	k = key(c, pid, v, n, 1);
+	if(k == nil)
+		return -1;
+	if(k->n > 0 && k->id[k->n-1] == id)
+		return 0;
+	if(k->n == k->a){
+		ids = realloc(k->id, (k->a+4)*2*sizeof(*ids));
+		if(ids == nil)
+			return -1;
+		k->id = ids;
+		k->a = (k->a+4)*2;
+	}
+	k->id[k->n++] = id;
+	return 0;
+}
+
+/* index the atoms of list l, whose enclosing lists' path is in s */
+static int
+walk(Secoll *c, Sexp *l, String *s, long id)
+{
+	Path *p;
+	Sexp *x;
+	char *op;
+	int n0;
+
+	n0 = s_len(s);
+	if(n0 > 0){
+		s_putc(s, '/');
+	}
+	op = se_op(l);
+	if(op != nil)
+		s_append(s, op);
+	s_terminate(s);
+	p = path(c, s_to_c(s), s_len(s), c->all);
+	if(p != nil && c->all)
+		p->indexed = 1;
+	if(p != nil)
+		for(x = l; x != nil; x = x->tl){
+			if(x->hd == nil)
+				continue;
+			if(x->hd->tag == Slist){
+				if(walk(c, x->hd, s, id) < 0)
+					return -1;
+			}else if(p->indexed && add(c, p->id, x->hd, id) < 0)
+				return -1;
+		}
+	else if(c->all)
+		return -1;	/* out of memory */
+	s->ptr = s->base + n0;
+	return 0;
+}
+
+/* an atom by itself is at the empty path */
+static int
+root(Secoll *c, Sexp *a, long id)
+{
+	Path *p;
+
+	p = path(c, "", 0, c->all);
+	if(p == nil)
+		return c->all? -1: 0;
+	if(c->all)
+		p->indexed = 1;
+	if(!p->indexed)
+		return 0;
+	return add(c, p->id, a, id);
+}
+
+static void
+purge(Secoll *c)
+{
+	long *map, i, j, n;
+	Key **l, *k;
+
+	map = malloc(c->nid*sizeof(*map));
+	if(map == nil)
+		return;
+	for(i = n = 0; i < c->nid; i++)
+		if(c->memb[i] != nil){
+			map[i] = n;
+			c->memb[n] = c->memb[i];
+			c->memb[n]->id = n;
+			n++;
+		}else
+			map[i] = -1;
+	c->nid = n;
+	for(i = 0; i < c->nktab; i++)
+		for(l = &c->ktab[i]; (k = *l) != nil;){
+			for(j = n = 0; j < k->n; j++)
+				if(map[k->id[j]] >= 0)
+					k->id[n++] = map[k->id[j]];
+			k->n = n;
+			if(n == 0){
+				*l = k->next;
+				free(k->id);
+				free(k);
+				c->nkey--;
+			}else
+				l = &k->next;
+		}
+	free(map);
+}
+
+static void
+drop(Secoll *c, Memb **l)
+{
+	Memb *m;
+
+	m = *l;
+	*l = m->next;
+	c->memb[m->id] = nil;
+	c->nlive--;
+	se_free(m->e);
+	free(m);
+	if(c->nid - c->nlive > c->nlive && c->nid - c->nlive >= Mindead)
+		purge(c);
+}
+
+/*
+ * add e to c, with a reference of its own; e must not be changed while there
+ */
+int
+se_collinsert(Secoll *c, Sexp *e)
+{
+	Memb **l, *m, **a;
+	String *s;
+	int r;
+
+	if(e == nil){
+		werrstr("se_collinsert: nil expression");
+		return -1;
+	}
+	lock(c);
+	l = memb(c, e);
+	if(*l != nil){
+		unlock(c);
+		werrstr("se_collinsert: already in collection");
+		return -1;
+	}
+	if(c->nid == c->amemb){
+		a = realloc(c->memb, (c->amemb+16)*2*sizeof(*a));
+		if(a == nil){
+			unlock(c);
+			werrstr("se_collinsert: out of memory");
+			return -1;
+		}
+		c->memb = a;
+		c->amemb = (c->amemb+16)*2;
+	}
+	m = mallocz(sizeof(*m), 1);
+	s = s_new();
+	if(m == nil || s == nil){
+		free(m);
+		s_free(s);
+		unlock(c);
+		werrstr("se_collinsert: out of memory");
+		return -1;
+	}
+	m->e = se_incref(e);
+	m->h = ptrhash(e);
+	m->id = c->nid++;
+	*l = m;
+	c->memb[m->id] = m;
+	c->nlive++;
+	if(e->tag == Slist)
+		r = walk(c, e, s, m->id);
+	else
+		r = root(c, e, m->id);
+	s_free(s);
+	if(r < 0){
+		drop(c, memb(c, e));	/* its ids in keys are ignored until purged */
+		unlock(c);
+		werrstr("se_collinsert: out of memory");
+		return -1;
+	}
+	if(c->nlive >= c->nmtab)
+		GROW(Memb, c->mtab, c->nmtab);
+	unlock(c);
+	return 0;
+}
+
+/*
+ * take e out of c, releasing c's reference
+ */
+int
+se_collremove(Secoll *c, Sexp *e)
+{
+	Memb **l;
+
+	lock(c);
+	l = memb(c, e);
+	if(*l == nil){
+		unlock(c);
+		werrstr("se_collremove: not in collection");
+		return -1;
+	}
+	drop(c, l);
+	unlock(c);
+	return 0;
+}
+
+/* the first index from i of an id in k no less than id */
+static long
+gallop(Key *k, long i, long id)
+{
+	long lo, hi, mid, step;
+
+	if(i >= k->n || k->id[i] >= id)
+		return i;
+	lo = i;
+	for(step = 1; lo+step < k->n && k->id[lo+step] < id; step <<= 1)
+		lo += step;
+	hi = lo+step < k->n? lo+step: k->n;
+	while(hi-lo > 1){
+		mid = (lo+hi)/2;
+		if(k->id[mid] < id)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return hi;
+}
+
+/*
+ * the members having every one of the nt (path, value) pairs in t,
+ * in the order inserted, in an array *vp to be freed by the caller;
+ * returns their number, or -1 on error.
+ * the trees remain c's, and valid while they are in it.
+ */
+long
+se_collfind(Secoll *c, Seterm *t, int nt, Sexp ***vp)
+{
+	Key **k, *x;
+	Path *p;
+	Sexp **v;
+	long *pos, i, id, n;
+	int j;
+
+	*vp = nil;
+	k = malloc(nt*sizeof(*k) + nt*sizeof(*pos) + 1);
+	if(k == nil){
+		werrstr("se_collfind: out of memory");
+		return -1;
+	}
+	pos = (long*)(k+nt);
+	lock(c);
+	n = c->nid;	/* without terms, every member */
+	for(j = 0; j < nt; j++){
+		p = path(c, t[j].path, strlen(t[j].path), 0);
+		if(p == nil || !p->indexed){
+			unlock(c);
+			free(k);
+			werrstr("se_collfind: path %s not indexed", t[j].path);
+			return -1;
+		}
+		k[j] = key(c, p->id, t[j].val, t[j].len, 0);
+		if(k[j] == nil){
+			unlock(c);
+			free(k);
+			return 0;
+		}
+		pos[j] = 0;
+	}
+	for(j = 1; j < nt; j++)	/* shortest first */
+		for(i = j; i > 0 && k[i]->n < k[i-1]->n; i--){
+			x = k[i];
+			k[i] = k[i-1];
+			k[i-1] = x;
+		}
+	if(nt > 0)
+		n = k[0]->n;
+	v = malloc(n*sizeof(*v) + 1);
+	if(v == nil){
+		unlock(c);
+		free(k);
+		werrstr("se_collfind: out of memory");
+		return -1;
+	}
+	n = 0;
+	for(i = 0; i < (nt > 0? k[0]->n: c->nid); i++){
+		id = nt > 0? k[0]->id[i]: i;
+		if(c->memb[id] == nil)
+			continue;
+		for(j = 1; j < nt; j++){
+			pos[j] = gallop(k[j], pos[j], id);
+			if(pos[j] == k[j]->n || k[j]->id[pos[j]] != id)
+				break;
+		}
+		if(j == nt || nt == 0)
+			v[n++] = c->memb[id]->e;
+	}
+	unlock(c);
+	free(k);
+	*vp = v;
+	return n;
+}
+
+/*
+ * release c's references to its members, and free c
+ */
+void
+se_collclose(Secoll *c)
+{
+	Path *p, *np;
+	Key *k, *nk;
+	long i;
+
+	if(c == nil)
+		return;
+	for(i = 0; i < c->nid; i++)
+		if(c->memb[i] != nil){
+			se_free(c->memb[i]->e);
+			free(c->memb[i]);
+		}
+	for(i = 0; c->ptab != nil && i < c->nptab; i++)
+		for(p = c->ptab[i]; p != nil; p = np){
+			np = p->next;
+			free(p);
+		}
+	for(i = 0; c->ktab != nil && i < c->nktab; i++)
+		for(k = c->ktab[i]; k != nil; k = nk){
+			nk = k->next;
+			free(k->id);
+			free(k);
+		}
+	free(c->memb);
+	free(c->ptab);
+	free(c->ktab);
+	free(c->mtab);
+	free(c);
+}
@@ -0,0 +1,181 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * a copy of a tree in one allocation, nodes in depth-first order,
+ * each atom's value (when not in the node) and hint just after it.
+ * only the root is counted and freed.  the count of every other node
+ * is minus its offset from the root, so that se_incref and se_free of it
+ * change the root's count instead: a reference to any node holds the whole block.
+ * the links within the block are not counted, and never change:
+ * se_patch copies the cells it alters, and se_unique the whole tree.
+ * things made later, such as Strings for small atoms or cached canonical forms,
+ * lie outside the block, and are released with it.
+ */
+
+typedef struct Block Block;
+
+struct Block {
+	vlong	size;	/* bytes following */
+};
+
+#define	RND(n)	(((n)+sizeof(vlong)-1) & ~(sizeof(vlong)-1))
+
+static vlong
+strsize(uint n)
+{
+	return RND(sizeof(String) + n + 1);
+}
+
+static vlong
+need(Sexp *e)
+{
+	vlong n;
+	uint m;
+
+	for(n = 0; e != nil; e = e->tl){
+		n += sizeof(Sexp);
+		if(e->tag != Slist){
+			if(e->hint != nil)
+				n += strsize(s_len(e->hint));
+			if(e->aflag & Abig)
+				n += RND(sizeof(Sebig));
+			else{
+				se_atom(e, &m);	/* formats a number */
+				if(m >= Ninline)
+					n += strsize(m);
+			}
+			break;
+		}
+		n += need(e->hd);
+	}
+	return n;
+}
+
+static String*
+str(uchar **pp, char *a, uint n)
+{
+	String *s;
+
+	s = (String*)*pp;
+	*pp += strsize(n);
+	memset(s, 0, sizeof(*s));
+	s->base = (char*)(s+1);
+	memmove(s->base, a, n);
+	s->base[n] = 0;
+	s->ptr = s->base + n;
+	s->end = s->ptr + 1;
+	s->ref = 1;
+	s->fixed = 1;
+	return s;
+}
+
+static Sexp*
+place(Sexp *e, uchar **pp, Sexp *root)
+{
+	Sexp *o, *first, **l;
+	char *a;
+	uint n;
+
+	first = nil;
+	for(l = &first; e != nil; l = &o->tl){
+		o = (Sexp*)*pp;
+		*pp += sizeof(Sexp);
+		memset(o, 0, sizeof(*o));
+		o->inuse = (uchar*)root - (uchar*)o;	/* 0 for the root, set by se_compact */
+		o->tag = e->tag;
+		o->hash = e->hash;
+		*l = o;
+		if(e->tag != Slist){
+			if(e->hint != nil)
+				o->hint = str(pp, s_to_c(e->hint), s_len(e->hint));
+			o->aflag = e->aflag & ~Acompact;
+			if(e->aflag & Abig){
+				o->big = (Sebig*)*pp;
+				*pp += RND(sizeof(Sebig));
+				*o->big = *e->big;
+				break;
+			}
+			o->num = e->num;
+			a = se_atom(e, &n);
+			if(n >= Ninline)
+				o->s = str(pp, a, n);
+			else{
+				memmove(o->inl, a, n);
+				o->inl[n] = 0;
+				o->ninl = n;
+			}
+			break;
+		}
+		o->lflag = e->lflag & ~Lcompact;
+		o->hd = place(e->hd, pp, root);
+		e = e->tl;
+	}
+	return first;
+}
+
+/*
+ * a compact copy of e, or nil if there's no memory for it
+ */
+Sexp*
+se_compact(Sexp *e)
+{
+	Block *b;
+	Sexp *o;
+	uchar *p;
+	vlong n;
+
+	if(e == nil)
+		return nil;
+	n = need(e);
+	if(n != (long)n){	/* offsets must fit in inuse */
+		werrstr("se_compact: tree too big");
+		return nil;
+	}
+	b = malloc(sizeof(*b) + n);
+	if(b == nil){
+		werrstr("se_compact: out of memory");
+		return nil;
+	}
+	b->size = n;
+	p = (uchar*)(b+1);
+	o = place(e, &p, (Sexp*)p);
+	o->inuse = 1;
+	if(o->tag == Slist)
+		o->lflag |= Lcompact;
+	else
+		o->aflag |= Acompact;
+	return o;
+}
+
+static void
+release(Sexp *e, uchar *lo, uchar *hi)
+{
+	for(; e != nil; e = e->tl){
+		if(e->tag != Slist){
+			if(e->s != nil && ((uchar*)e->s < lo || (uchar*)e->s >= hi))
+				s_free(e->s);
+			if(e->hint != nil && ((uchar*)e->hint < lo || (uchar*)e->hint >= hi))
+				s_free(e->hint);
+			return;
+		}
+		free(e->pk);
+		release(e->hd, lo, hi);
+	}
+}
+
+/*
+ * called by se_free when the root's count reaches zero
+ */
+void
+_se_freecompact(Sexp *e)
+{
+	Block *b;
+
+	b = (Block*)e - 1;
+	release(e, (uchar*)(b+1), (uchar*)(b+1) + b->size);
+	free(b);
+}
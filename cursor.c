@@ -0,0 +1,167 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * traversal with an explicit stack, so depth is limited only by memory
+ */
+
+typedef struct Level Level;
+
+struct Level {
+	Sexp*	list;	/* list being traversed */
+	Sexp*	cell;	/* its cell holding the current element */
+};
+
+struct Secursor {
+	Sexp*	cur;
+	Level*	stk;
+	int	n;
+	int	a;
+};
+
+static int
+push(Level **stk, int *n, int *a, Sexp *l)
+{
+	Level *s;
+
+	if(*n == *a){
+		s = realloc(*stk, (*a+32)*sizeof(*s));
+		if(s == nil){
+			werrstr("out of memory");
+			return -1;
+		}
+		*stk = s;
+		*a += 32;
+	}
+	s = &(*stk)[(*n)++];
+	s->list = l;
+	s->cell = l;
+	return 0;
+}
+
+Secursor*
+se_cursor(Sexp *e)
+{
+	Secursor *c;
+
+	c = mallocz(sizeof(*c), 1);
+	if(c == nil)
+		return nil;
+	c->cur = e;
+	return c;
+}
+
+void
+se_freecursor(Secursor *c)
+{
+	if(c == nil)
+		return;
+	free(c->stk);
+	free(c);
+}
+
+/* the current node */
+Sexp*
+se_at(Secursor *c)
+{
+	return c->cur;
+}
+
+/* move to the first element of the current list */
+Sexp*
+se_down(Secursor *c)
+{
+	Sexp *l;
+
+	l = c->cur;
+	if(l == nil || l->tag != Slist || l->hd == nil)
+		return nil;
+	if(push(&c->stk, &c->n, &c->a, l) < 0)
+		return nil;
+	c->cur = l->hd;
+	return c->cur;
+}
+
+/* move to the next element of the enclosing list */
+Sexp*
+se_next(Secursor *c)
+{
+	Level *s;
+	Sexp *l;
+
+	if(c->n == 0)
+		return nil;
+	s = &c->stk[c->n-1];
+	l = s->cell->tl;
+	if(l == nil)
+		return nil;
+	s->cell = l;
+	c->cur = l->hd;
+	return c->cur;
+}
+
+/* move to the enclosing list */
+Sexp*
+se_up(Secursor *c)
+{
+	if(c->n == 0)
+		return nil;
+	c->cur = c->stk[--c->n].list;
+	return c->cur;
+}
+
+/*
+ * visit e and everything in it, calling pre before a node's elements
+ * and post after them; either may be nil.
+ * a positive value from pre skips the node's elements (post is still called).
+ * a negative value from either stops the walk, and is returned.
+ */
+int
+se_walk(Sexp *e, int (*pre)(Sexp*, void*), int (*post)(Sexp*, void*), void *arg)
+{
+	Level *stk, *s;
+	Sexp *x, *l;
+	int n, a, r;
+
+	if(e == nil)
+		return 0;
+	stk = nil;
+	n = a = 0;
+	x = e;
+	for(;;){
+		r = 0;
+		if(pre != nil && (r = pre(x, arg)) < 0)
+			break;
+		if(r == 0 && x->tag == Slist && x->hd != nil){
+			if(push(&stk, &n, &a, x) < 0){
+				r = -1;
+				break;
+			}
+			x = x->hd;
+			continue;
+		}
+		/* x is finished; so is each list whose last element it completes */
+		for(;;){
+			r = 0;
+			if(post != nil && (r = post(x, arg)) < 0)
+				goto Out;
+			if(n == 0)
+				goto Out;
+			s = &stk[n-1];
+			l = s->cell->tl;
+			if(l != nil){
+				s->cell = l;
+				x = l->hd;
+				break;
+			}
+			x = s->list;
+			n--;
+		}
+	}
+Out:
+	free(stk);
+	return r;
+}
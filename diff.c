@@ -0,0 +1,424 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * differences between trees, as an edit script that is itself an S-expression:
+ * a list of operations, applied in order,
+ *	(replace path value)
+ *	(insert path value)
+ *	(delete path)
+ * where a path is a list of element indices from the root,
+ * interpreted in the tree as changed by the preceding operations.
+ * for insert and delete, the last index is the position in the enclosing list.
+ * the hashes of both trees are computed first, once, bottom-up, and kept in the nodes;
+ * thereafter subtrees with different hashes differ at the cost of one comparison,
+ * and only those with equal hashes are compared in full, once each,
+ * so the time is linear in the size of the trees,
+ * plus the alignment of the differing parts of lists, bounded by Maxlcs.
+ */
+
+enum{
+	Maxlcs=	64*1024,	/* largest table for aligning the differing part of two lists */
+};
+
+typedef struct Diff Diff;
+
+struct Diff {
+	Sexp*	ops;
+	Sexp*	last;
+	int*	path;
+	int	npath;
+	int	apath;
+	int	err;
+};
+
+/*
+ * hash of an atom's tag, hint and value, or of the elements of list e onwards,
+ * cached in the node
+ */
+uint
+se_hash(Sexp *e)
+{
+	uint h, n;
+	uchar *p, *ep;
+	Sexp *l;
+
+	if(e == nil)
+		return 0x9e3779b9;
+	if(e->hash != 0)
+		return e->hash;
+	h = 2166136261U ^ e->tag;
+	if(e->tag == Slist){
+		if(e->hd != nil)
+			for(l = e; l != nil; l = l->tl)
+				h = (h ^ se_hash(l->hd)) * 16777619;
+	}else{
+		if(e->hint != nil)
+			for(p = (uchar*)s_to_c(e->hint), ep = p+s_len(e->hint); p < ep; p++)
+				h = (h ^ *p) * 16777619;
+		p = (uchar*)se_atom(e, &n);
+		for(ep = p+n; p < ep; p++)
+			h = (h ^ *p) * 16777619;
+	}
+	if(h == 0)
+		h = 1;
+	e->hash = h;
+	return h;
+}
+
+/* equality, settled by the hashes when they differ */
+static int
+eqh(Sexp *a, Sexp *b)
+{
+	if(a == b)
+		return 1;
+	if(a == nil || b == nil || se_hash(a) != se_hash(b))
+		return 0;
+	return se_eq(a, b);
+}
+
+static int
+push(Diff *d, int i)
+{
+	int *p;
+
+	if(d->npath == d->apath){
+		p = realloc(d->path, (d->apath+16)*sizeof(*p));
+		if(p == nil){
+			d->err = 1;
+			return -1;
+		}
+		d->path = p;
+		d->apath += 16;
+	}
+	d->path[d->npath++] = i;
+	return 0;
+}
+
+static void
+emit(Diff *d, char *op, int i, Sexp *v)
+{
+	Sexp *path, *l, *o;
+	int j;
+
+	if(d->err)
+		return;
+	path = se_cons(nil, nil);
+	l = path;
+	for(j = 0; j < d->npath; j++){
+		if(l->hd != nil)
+			l = l->tl = se_cons(nil, nil);
+		l->hd = se_int(d->path[j]);
+	}
+	if(i >= 0){
+		if(l->hd != nil)
+			l = l->tl = se_cons(nil, nil);
+		l->hd = se_int(i);
+	}
+	if(v != nil)
+		o = se_form(op, path, se_incref(v), nil);
+	else
+		o = se_form(op, path, nil);
+	if(d->last == nil){
+		d->ops->hd = o;
+		d->last = d->ops;
+	}else
+		d->last = d->last->tl = se_cons(o, nil);
+}
+
+static void	diff(Diff*, Sexp*, Sexp*);
+
+/* the unmatched elements between two matches: pair what can be paired, then delete or insert */
+static void
+flush(Diff *d, Sexp **a, int na, Sexp **b, int nb, int *kp)
+{
+	int x;
+
+	for(x = 0; x < na && x < nb; x++){
+		if(push(d, (*kp)++) < 0)
+			return;
+		diff(d, a[x], b[x]);
+		d->npath--;
+	}
+	for(; x < na; x++)
+		emit(d, "delete", *kp, nil);
+	for(; x < nb; x++)
+		emit(d, "insert", (*kp)++, b[x]);
+}
+
+static Sexp**
+elements(Sexp *e, int *np)
+{
+	Sexp **v, *l;
+	int n;
+
+	n = se_len(e);
+	v = malloc((n+1)*sizeof(*v));
+	if(v == nil)
+		return nil;
+	n = 0;
+	for(l = se_els(e); l != nil; l = l->tl)
+		v[n++] = l->hd;
+	*np = n;
+	return v;
+}
+
+static void
+difflist(Diff *d, Sexp *a, Sexp *b)
+{
+	Sexp **va, **vb, **ma, **mb;
+	int m, n, i, j, k, ea, eb, mm, mn, i0, j0, w;
+	int *t;
+
+	va = elements(a, &m);
+	vb = elements(b, &n);
+	if(va == nil || vb == nil){
+		free(va);
+		free(vb);
+		d->err = 1;
+		return;
+	}
+	for(k = 0; k < m && k < n && eqh(va[k], vb[k]); k++)
+		{}
+	for(ea = m, eb = n; ea > k && eb > k && eqh(va[ea-1], vb[eb-1]); ea--, eb--)
+		{}
+	ma = va+k;
+	mb = vb+k;
+	mm = ea-k;
+	mn = eb-k;
+	t = nil;
+	if(mm > 0 && mn > 0 && (vlong)(mm+1)*(mn+1) <= Maxlcs)
+		t = malloc((mm+1)*(mn+1)*sizeof(*t));
+	if(t == nil){
+		/* no alignment: pair elements by position */
+		flush(d, ma, mm, mb, mn, &k);
+	}else{
+		/*
+		 * longest common subsequence of the differing parts, from the end,
+		 * by hash alone; matches are confirmed as the table is followed
+		 */
+		w = mn+1;
+		for(i = mm; i >= 0; i--)
+			for(j = mn; j >= 0; j--){
+				if(i == mm || j == mn)
+					t[i*w+j] = 0;
+				else if(se_hash(ma[i]) == se_hash(mb[j]))
+					t[i*w+j] = t[(i+1)*w+j+1]+1;
+				else if(t[(i+1)*w+j] >= t[i*w+j+1])
+					t[i*w+j] = t[(i+1)*w+j];
+				else
+					t[i*w+j] = t[i*w+j+1];
+			}
+		i = j = 0;
+		i0 = j0 = 0;
+		while(i < mm && j < mn){
+			if(t[i*w+j] == t[(i+1)*w+j+1]+1 && eqh(ma[i], mb[j])){
+				flush(d, ma+i0, i-i0, mb+j0, j-j0, &k);
+				k++;
+				i0 = ++i;
+				j0 = ++j;
+			}else if(t[(i+1)*w+j] >= t[i*w+j+1])
+				i++;
+			else
+				j++;
+		}
+		flush(d, ma+i0, mm-i0, mb+j0, mn-j0, &k);
+		free(t);
+	}
+	free(va);
+	free(vb);
+}
+
+/* a and b are at the current path */
+static void
+diff(Diff *d, Sexp *a, Sexp *b)
+{
+	if(d->err || eqh(a, b))
+		return;
+	if(a != nil && b != nil && a->tag == Slist && b->tag == Slist)
+		difflist(d, a, b);
+	else
+		emit(d, "replace", -1, b);
+}
+
+/*
+ * edit script that changes old into new.
+ * the script refers to subtrees of new, not copies.
+ */
+Sexp*
+se_diff(Sexp *old, Sexp *new)
+{
+	Diff d;
+
+	memset(&d, 0, sizeof(d));
+	d.ops = se_cons(nil, nil);
+	se_hash(old);
+	se_hash(new);
+	diff(&d, old, new);
+	free(d.path);
+	if(d.err){
+		se_free(d.ops);
+		werrstr("se_diff: out of memory");
+		return nil;
+	}
+	return d.ops;
+}
+
+/*
+ * a reference to e that can be changed: e itself if it isn't shared
+ * or part of a compact tree, otherwise a copy of the cell, sharing its contents
+ */
+static Sexp*
+own(Sexp *e)
+{
+	Sexp *c;
+
+	if(e->inuse == 1 && (e->lflag & Lcompact) == 0){
+		_se_dirty(e);
+		return e;
+	}
+	c = se_cons(se_incref(e->hd), se_incref(e->tl));
+	c->lflag = e->lflag & ~Lcompact;
+	se_free(e);
+	return c;
+}
+
+/* the cell of list *lp holding element i, making the cells on the way changeable */
+static Sexp*
+cell(Sexp **lp, int i)
+{
+	Sexp *l;
+
+	if(*lp == nil || (*lp)->tag != Slist)
+		return nil;
+	l = *lp = own(*lp);
+	if(l->hd == nil)
+		return nil;
+	for(; i > 0; i--){
+		if(l->tl == nil)
+			return nil;
+		l = l->tl = own(l->tl);
+	}
+	return l;
+}
+
+static int
+patch1(Sexp **tp, Sexp *op)
+{
+	Sexp **lp, *l, *c, *p, *v;
+	char *s;
+	int i, last;
+
+	s = se_op(op);
+	p = se_hd(se_tl(op));
+	v = se_hd(se_tl(se_tl(op)));
+	if(s == nil || p == nil || p->tag != Slist)
+		return -1;
+	lp = tp;
+	last = -1;
+	for(p = se_els(p); p != nil; p = p->tl){
+		if(se_asint(p->hd, &i) < 0 || i < 0)
+			return -1;
+		if(last >= 0){
+			l = cell(lp, last);
+			if(l == nil)
+				return -1;
+			lp = &l->hd;
+		}
+		last = i;
+	}
+	if(strcmp(s, "replace") == 0){
+		if(v == nil)
+			return -1;
+		if(last >= 0){
+			l = cell(lp, last);
+			if(l == nil)
+				return -1;
+			lp = &l->hd;
+		}
+		se_free(*lp);
+		*lp = se_incref(v);
+		return 0;
+	}
+	if(last < 0 || *lp == nil || (*lp)->tag != Slist)
+		return -1;
+	if(strcmp(s, "insert") == 0){
+		if(v == nil)
+			return -1;
+		l = *lp = own(*lp);
+		if(l->hd == nil){
+			if(last != 0)
+				return -1;
+			l->hd = se_incref(v);
+			return 0;
+		}
+		if(last == 0){
+			l->tl = se_cons(l->hd, l->tl);
+			l->hd = se_incref(v);
+			return 0;
+		}
+		l = cell(lp, last-1);
+		if(l == nil)
+			return -1;
+		l->tl = se_cons(se_incref(v), l->tl);
+		return 0;
+	}
+	if(strcmp(s, "delete") == 0){
+		if(last == 0){
+			l = cell(lp, 0);
+			if(l == nil)
+				return -1;
+			se_free(l->hd);
+			l->hd = nil;
+			if(l->tl != nil){
+				c = own(l->tl);
+				l->hd = c->hd;
+				l->tl = c->tl;
+				c->hd = c->tl = nil;
+				se_free(c);
+			}
+			return 0;
+		}
+		l = cell(lp, last-1);
+		if(l == nil || l->tl == nil)
+			return -1;
+		c = own(l->tl);
+		l->tl = c->tl;
+		c->tl = nil;
+		se_free(c);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * apply an edit script made by se_diff to tree, which belongs to se_patch,
+ * and return the result.  cells of tree that are not shared are changed in place;
+ * shared ones are copied on the way to a change, and unchanged subtrees are shared.
+ * on error, tree is freed and nil returned.
+ */
+Sexp*
+se_patch(Sexp *tree, Sexp *script)
+{
+	Sexp *l;
+	int n;
+
+	if(script == nil || script->tag != Slist){
+		se_free(tree);
+		werrstr("se_patch: script is not a list");
+		return nil;
+	}
+	n = 0;
+	for(l = se_els(script); l != nil; l = l->tl){
+		if(patch1(&tree, l->hd) < 0){
+			se_free(tree);
+			werrstr("se_patch: bad operation %d", n);
+			return nil;
+		}
+		n++;
+	}
+	return tree;
+}
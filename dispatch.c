@@ -0,0 +1,232 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * dispatch on a list's operator through a perfect hash of the operator names,
+ * made by hash and displace: the names are split into buckets by one hash,
+ * and each bucket is given a seed for a second hash that sends its names
+ * to slots not yet taken, largest buckets first.
+ * a lookup is two hashes of the operator's bytes and one comparison,
+ * however many operators there are.
+ */
+
+enum{
+	Ntries=	1<<16,	/* seeds tried for a bucket before the table is made bigger */
+	Nbig=	4,	/* tables tried, each twice as big as the last */
+};
+
+typedef struct Name Name;
+typedef struct Slot Slot;
+
+struct Slot {
+	char*	name;	/* nil if free */
+	uint	len;
+	int	(*fn)(Sexp*, void*);
+};
+
+struct Sedispatch {
+	uint*	seed;	/* by bucket */
+	uint	nbucket;
+	Slot*	slot;
+	uint	nslot;
+	int	(*dflt)(Sexp*, void*);
+};
+
+struct Name {	/* while making the table */
+	Seop*	op;
+	uint	len;
+	uint	bucket;
+	uint	slot;
+};
+
+static uint
+hash(char *s, uint n, uint seed)
+{
+	uint h;
+
+	h = 2166136261U ^ seed*0x9E3779B9U;
+	while(n-- > 0)
+		h = (h ^ (uchar)*s++) * 16777619;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6DU;
+	h ^= h >> 12;
+	return h;
+}
+
+static uint
+pow2(uint n)
+{
+	uint m;
+
+	for(m = 1; m < n; m <<= 1)
+		;
+	return m;
+}
+
+/* find a seed sending the k names of a bucket to distinct free slots */
+static int
+fit(Sedispatch *d, Name **nm, int k)
+{
+	uint s;
+	int i, j;
+
+	for(s = 1; s < Ntries; s++){
+		for(i = 0; i < k; i++){
+			nm[i]->slot = hash(nm[i]->op->name, nm[i]->len, s) & (d->nslot-1);
+			if(d->slot[nm[i]->slot].name != nil)
+				break;
+			for(j = 0; j < i; j++)
+				if(nm[j]->slot == nm[i]->slot)
+					break;
+			if(j < i)
+				break;
+		}
+		if(i == k){
+			d->seed[nm[0]->bucket] = s;
+			for(i = 0; i < k; i++){
+				d->slot[nm[i]->slot].name = nm[i]->op->name;
+				d->slot[nm[i]->slot].len = nm[i]->len;
+				d->slot[nm[i]->slot].fn = nm[i]->op->fn;
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* place every bucket, largest first, in a table of nslot slots */
+static int
+place(Sedispatch *d, Name *nm, int n, Name **tmp)
+{
+	uint *size, b, max;
+	int i, k;
+
+	size = mallocz(d->nbucket*sizeof(*size), 1);
+	if(size == nil)
+		return -1;
+	max = 0;
+	for(i = 0; i < n; i++)
+		if(++size[nm[i].bucket] > max)
+			max = size[nm[i].bucket];
+	for(; max > 0; max--)
+		for(b = 0; b < d->nbucket; b++){
+			if(size[b] != max)
+				continue;
+			k = 0;
+			for(i = 0; i < n; i++)
+				if(nm[i].bucket == b)
+					tmp[k++] = &nm[i];
+			if(fit(d, tmp, k) < 0){
+				free(size);
+				return -1;
+			}
+		}
+	free(size);
+	return 0;
+}
+
+/*
+ * a table calling ops[i].fn for the lists whose operator is ops[i].name,
+ * or the fn of an entry with a nil name for any other.
+ * the names must remain valid while the table is.
+ */
+Sedispatch*
+se_dispatchopen(Seop *ops, int nops)
+{
+	Sedispatch *d;
+	Name *nm, **tmp;
+	int i, j, n, try;
+
+	d = mallocz(sizeof(*d), 1);
+	nm = malloc(nops*sizeof(*nm) + 1);
+	tmp = malloc(nops*sizeof(*tmp) + 1);
+	if(d == nil || nm == nil || tmp == nil){
+		werrstr("se_dispatchopen: out of memory");
+		goto Err;
+	}
+	n = 0;
+	for(i = 0; i < nops; i++){
+		if(ops[i].name == nil){
+			d->dflt = ops[i].fn;
+			continue;
+		}
+		nm[n].op = &ops[i];
+		nm[n].len = strlen(ops[i].name);
+		for(j = 0; j < n; j++)
+			if(nm[j].len == nm[n].len && memcmp(nm[j].op->name, ops[i].name, nm[n].len) == 0){
+				werrstr("se_dispatchopen: duplicate operator %s", ops[i].name);
+				goto Err;
+			}
+		n++;
+	}
+	d->nbucket = pow2((n+1)/2);	/* two names to a bucket, on average */
+	for(i = 0; i < n; i++)
+		nm[i].bucket = hash(nm[i].op->name, nm[i].len, 0) & (d->nbucket-1);
+	d->seed = malloc(d->nbucket*sizeof(*d->seed));
+	if(d->seed == nil){
+		werrstr("se_dispatchopen: out of memory");
+		goto Err;
+	}
+	d->nslot = pow2(n + n/4 + 1);
+	for(try = 0; try < Nbig; try++){
+		free(d->slot);
+		d->slot = mallocz(d->nslot*sizeof(*d->slot), 1);
+		if(d->slot == nil){
+			werrstr("se_dispatchopen: out of memory");
+			goto Err;
+		}
+		memset(d->seed, 0, d->nbucket*sizeof(*d->seed));
+		if(place(d, nm, n, tmp) == 0){
+			free(nm);
+			free(tmp);
+			return d;
+		}
+		d->nslot *= 2;
+	}
+	werrstr("se_dispatchopen: can't make table");
+Err:
+	free(nm);
+	free(tmp);
+	se_dispatchclose(d);
+	return nil;
+}
+
+/*
+ * call the function for e's operator with e and arg, returning its result;
+ * -1 if there is none
+ */
+int
+se_dispatch(Sedispatch *d, Sexp *e, void *arg)
+{
+	Sexp *op;
+	Slot *s;
+	char *a;
+	uint n, h;
+
+	op = nil;
+	if(e != nil && e->tag == Slist)
+		op = e->hd;
+	if(op != nil && op->tag == Sstring && (a = se_atom(op, &n)) != nil){
+		h = hash(a, n, 0);
+		s = &d->slot[hash(a, n, d->seed[h & (d->nbucket-1)]) & (d->nslot-1)];
+		if(s->name != nil && s->len == n && memcmp(s->name, a, n) == 0)
+			return s->fn(e, arg);
+	}
+	if(d->dflt != nil)
+		return d->dflt(e, arg);
+	werrstr("se_dispatch: unknown operator");
+	return -1;
+}
+
+void
+se_dispatchclose(Sedispatch *d)
+{
+	if(d == nil)
+		return;
+	free(d->seed);
+	free(d->slot);
+	free(d);
+}
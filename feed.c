@@ -0,0 +1,150 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * incremental parsing of input that arrives in pieces,
+ * for programs that cannot block in se_read
+ */
+
+struct Sefeed {
+	Scan	scan;
+	uchar*	buf;	/* bytes of an incomplete expression */
+	long	nbuf;
+	long	abuf;
+	vlong	off;	/* input offset of next byte */
+	int	broken;	/* after a syntax error */
+};
+
+Sefeed*
+se_feedopen(void)
+{
+	Sefeed *f;
+
+	f = mallocz(sizeof(*f), 1);
+	if(f == nil)
+		return nil;
+	_se_scaninit(&f->scan);
+	return f;
+}
+
+void
+se_feedclose(Sefeed *f)
+{
+	if(f == nil)
+		return;
+	free(f->buf);
+	free(f);
+}
+
+static int
+save(Sefeed *f, uchar *a, long n)
+{
+	uchar *b;
+	long m;
+
+	if(f->nbuf+n > f->abuf){
+		m = f->abuf*2;
+		if(m < f->nbuf+n)
+			m = f->nbuf+n+128;
+		b = realloc(f->buf, m);
+		if(b == nil){
+			werrstr("out of memory");
+			return -1;
+		}
+		f->buf = b;
+		f->abuf = m;
+	}
+	memmove(f->buf+f->nbuf, a, n);
+	f->nbuf += n;
+	return 0;
+}
+
+static int
+isspace(int c)
+{
+	return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+/*
+ * consume bytes from a up to the end of the first complete expression,
+ * setting *ep to that expression, or to nil if a has been consumed without completing one.
+ * returns the number of bytes consumed, or -1 on error.
+ * n of zero marks the end of the input.
+ */
+long
+se_feed(Sefeed *f, void *a, long n, Sexp **ep)
+{
+	uchar *p, *p0, *e;
+	Sexp *x;
+	int r;
+
+	*ep = nil;
+	if(f->broken){
+		werrstr("se_feed: input already in error");
+		return -1;
+	}
+	if(n == 0){
+		r = _se_scanend(&f->scan);
+		if(r < 0){
+			f->broken = 1;
+			werrstr("%s at offset %lld", f->scan.diag, f->off);
+			return -1;
+		}
+		if(r > 0){
+			x = se_unpack((char*)f->buf, f->nbuf, nil);
+			f->nbuf = 0;
+			if(x == nil){
+				f->broken = 1;
+				return -1;
+			}
+			*ep = x;
+		}
+		return 0;
+	}
+	p = a;
+	e = p+n;
+	if(f->nbuf == 0){
+		while(p < e && isspace(*p))
+			p++;
+		if(p == e){
+			f->off += n;
+			return n;
+		}
+	}
+	p0 = p;
+	r = _se_scan(&f->scan, &p, e);
+	if(r < 0){
+		f->broken = 1;
+		werrstr("%s at offset %lld", f->scan.diag, f->off + (p - (uchar*)a));
+		return -1;
+	}
+	if(r == 0){
+		if(save(f, p0, e-p0) < 0){
+			f->broken = 1;
+			return -1;
+		}
+		f->off += n;
+		return n;
+	}
+	if(f->nbuf == 0)
+		x = se_unpack((char*)p0, p-p0, nil);	/* whole expression in this piece */
+	else{
+		if(save(f, p0, p-p0) < 0){
+			f->broken = 1;
+			return -1;
+		}
+		x = se_unpack((char*)f->buf, f->nbuf, nil);
+		f->nbuf = 0;
+	}
+	if(x == nil){
+		f->broken = 1;
+		return -1;
+	}
+	n = p - (uchar*)a;
+	f->off += n;
+	*ep = x;
+	return n;
+}
@@ -0,0 +1,95 @@
+/*
+ * tests of sexp.hh, for a C++ compiler, linked with libsexp:
+ * prints a line for each check, as stest does, and exits with status 1 if any fail
+ */
+
+extern "C" {
+#include <u.h>
+#include <libc.h>
+}
+#include <cstdio>
+#include "sexp.hh"
+
+using sexp::Buffer;
+using sexp::Builder;
+using sexp::Ref;
+using sexp::View;
+
+static int	nfail;
+
+static void
+check(const char *what, const char *arg, bool ok)
+{
+	std::printf("%s %s: %s\n", what, arg, ok? "ok": "FAIL");
+	if(!ok)
+		nfail++;
+}
+
+static void
+refs(void)
+{
+	Ref e = Ref::parse("(a (b c) \"a string longer than an inline atom\")");
+	Sexp *x = e.get();
+	long n = x->inuse;
+
+	Ref s = e.share();
+	check("ref", "share", s.get() == x && x->inuse == n+1);
+	Ref m(std::move(s));
+	check("ref", "move", !s && m.get() == x && x->inuse == n+1);
+	m.reset();
+	check("ref", "reset", !m && x->inuse == n);
+	Ref c = e.copy();
+	check("ref", "copy", c.get() != x && c == e);
+
+	Ref sub = Ref::share(e[1]);
+	e.reset();
+	check("ref", "subtree", sub.op() == "b" && sub.len() == 2);
+
+	std::string t;
+	for(View v : c)
+		t += v.islist()? std::string("()"): std::string(v.atom());
+	check("view", "elements", t == "a()a string longer than an inline atom");
+	check("view", "out of range", !c[3] && !c[0].hd() && c[0].op().empty());
+}
+
+static void
+builds(void)
+{
+	Builder b;
+	b.open();
+	b.str("cert");
+	b.open();
+	b.str("a string longer than an inline atom");
+	b.close();
+	Buffer a(3);
+	memmove(a.data(), "\0\1\2", 3);
+	uchar *p = a.data();
+	b.data(std::move(a));
+	Ref x = Ref::str("shared");
+	b.push(View(x));
+	b.push(Ref::num(42));
+	b.close();
+	Ref e = b.finish();
+	Ref w = Ref::parse("(cert (\"a string longer than an inline atom\") #000102# shared 42)");
+	check("builder", "tree", e && e == w && a.data() == nullptr && p != nullptr);
+	check("builder", "shared", x.get()->inuse == 2);
+
+	Builder u;
+	u.open();
+	check("builder", "unclosed", !u.finish());
+	Builder v;
+	v.str("a");
+	check("builder", "two expressions", !v.str("b") && !v.finish());
+
+	/* a nil builder, as when out of memory */
+	Sexp *y = Ref::str("atom").release();
+	check("builder", "nil", se_push(nullptr, y) < 0 && se_open(nullptr) < 0 && se_finish(nullptr) == nullptr);
+}
+
+int
+main(void)
+{
+	refs();
+	builds();
+	return nfail != 0;
+}
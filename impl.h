@@ -0,0 +1,106 @@
+/*
+ * library-private interfaces shared between the source files
+ */
+
+enum{
+	Maxtoken=	1024*1024,	/* should be more than enough */
+	RIVEST=	0,		/* don't enforce Rivest's s-expr requirement that tokens can't start with digits */
+};
+
+#define	Maxatom	(1LL<<56)	/* upper bound on any verbatim length, so lengths can't overflow */
+
+/* the root counting node e of a compact tree, whose inuse is < Sstatic (see compact.c) */
+#define	compactroot(e)	((Sexp*)((uchar*)(e) + (e)->inuse))
+
+enum{
+	/* Sexp.aflag */
+	Anum=	1<<0,	/* num holds the atom's value */
+	Anotnum=	1<<1,	/* atom isn't a number */
+	Anotext=	1<<2,	/* value not yet formatted from num */
+	Abig=	1<<3,	/* value is described by big, and loaded on demand */
+	Acompact=	1<<4,	/* root of a tree made by se_compact; never copied */
+
+	/* Sexp.lflag */
+	Lcache=	1<<0,	/* keep the canonical form when packed */
+	Lcompact=	1<<1,	/* as Acompact */
+};
+
+typedef struct Scan Scan;
+
+/*
+ * a big atom's value, left outside memory by the parser
+ */
+struct Sebig {
+	int	fd;	/* file holding it, or -1 */
+	vlong	off;	/* its offset in the file */
+	vlong	len;
+	uchar*	base;	/* or its address in the parser's input */
+};
+
+/*
+ * resumable recogniser for the extent of one expression,
+ * used to frame input that arrives in pieces
+ */
+struct Scan {
+	int	state;
+	int	depth;	/* open lists */
+	int	hint;	/* 1: in display hint; 2: in the value it qualifies */
+	vlong	n;	/* decimal length, or bytes or digits still to come */
+	vlong	max;	/* longest verbatim atom */
+	int	form;	/* Sadvanced or Stransport once seen, else Scanonical */
+	uchar*	t0;	/* start of transport encoding, if whole */
+	int	whole;	/* the input is all in one buffer */
+	char*	diag;
+};
+
+Sexp*	_se_alloc(void);
+int	_se_allocv(Sexp**, int);
+void	_se_release(Sexp*);
+String*	_b_new(void*, uint);
+void	_se_dirty(Sexp*);
+Sexp*	_se_mkatom(int, void*, uint, String*);
+void	_se_freecompact(Sexp*);
+
+void	_se_scaninit(Scan*);
+int	_se_scan(Scan*, uchar**, uchar*);
+int	_se_scanend(Scan*);
+
+typedef struct Bind Bind;
+typedef struct Pop Pop;
+
+enum{
+	Maxbind=	32,	/* bindings in one pattern */
+
+	/* pattern operations */
+	Popen=	0,
+	Pclose,
+	Plit,	/* literal atom */
+	Pstr,	/* %s: char* */
+	Pint,	/* %d: int */
+	Pdata,	/* %S: String* */
+	Pany,	/* %e: Sexp* */
+	Prest,	/* %*: remaining elements of list */
+};
+
+struct Pop {
+	int	op;
+	int	arg;	/* index of binding */
+	Sexp*	lit;
+};
+
+struct Sepat {
+	int	nop;
+	int	nbind;
+	Pop*	op;
+};
+
+struct Bind {
+	Sepat*	pat;
+	void*	arg[Maxbind];
+	uchar	set[Maxbind];
+	int	own;	/* bound values belong to the caller */
+};
+
+void	_se_bindinit(Bind*, Sepat*, va_list, int);
+void	_se_unbind(Bind*);
+int	_se_matchx(Bind*, int*, Sexp*);
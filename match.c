@@ -0,0 +1,298 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * match an expression against a template, binding values from it:
+ *	se_compile("(ipconfig (ipaddr %s) (ipgw %s) (ipforwarding %d))")
+ * the template is compiled to a sequence of operations
+ * that se_match follows in step with a traversal of the expression
+ */
+
+static int
+isspace(int c)
+{
+	return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+static Pop*
+newop(Sepat *p, int op)
+{
+	Pop *o;
+
+	if((p->nop & 15) == 0){
+		o = realloc(p->op, (p->nop+16)*sizeof(*o));
+		if(o == nil)
+			return nil;
+		p->op = o;
+	}
+	o = &p->op[p->nop++];
+	o->op = op;
+	o->arg = -1;
+	o->lit = nil;
+	return o;
+}
+
+Sepat*
+se_compile(char *s)
+{
+	Sepat *p;
+	Pop *o;
+	Sexp *e;
+	char *es;
+	int depth, n, op;
+
+	p = mallocz(sizeof(*p), 1);
+	if(p == nil)
+		return nil;
+	depth = 0;
+	n = 0;	/* items at outer level */
+	for(;;){
+		while(isspace(*s))
+			s++;
+		if(*s == 0)
+			break;
+		if(depth == 0 && n++ > 0){
+			werrstr("se_compile: more than one expression");
+			goto Err;
+		}
+		switch(*s){
+		case '(':
+			op = Popen;
+			depth++;
+			s++;
+			break;
+		case ')':
+			if(depth == 0){
+				werrstr("se_compile: unexpected )");
+				goto Err;
+			}
+			op = Pclose;
+			depth--;
+			s++;
+			break;
+		case '%':
+			switch(s[1]){
+			case 's':	op = Pstr; break;
+			case 'd':	op = Pint; break;
+			case 'S':	op = Pdata; break;
+			case 'e':	op = Pany; break;
+			case '*':	op = Prest; break;
+			default:
+				werrstr("se_compile: unknown conversion %%%c", s[1]);
+				goto Err;
+			}
+			s += 2;
+			if(op == Prest){
+				while(isspace(*s))
+					s++;
+				if(*s != ')'){
+					werrstr("se_compile: %%* must end a list");
+					goto Err;
+				}
+			}
+			break;
+		default:
+			e = se_parse(s, &es);
+			if(e == nil){
+				werrstr("se_compile: %r");
+				goto Err;
+			}
+			if(e->tag == Slist){
+				se_free(e);
+				werrstr("se_compile: list literal not allowed");
+				goto Err;
+			}
+			s = es;
+			o = newop(p, Plit);
+			if(o == nil){
+				se_free(e);
+				goto Nomem;
+			}
+			o->lit = e;
+			continue;
+		}
+		o = newop(p, op);
+		if(o == nil)
+			goto Nomem;
+		if(op >= Pstr && op <= Pany){
+			if(p->nbind >= Maxbind){
+				werrstr("se_compile: too many conversions");
+				goto Err;
+			}
+			o->arg = p->nbind++;
+		}
+	}
+	if(depth != 0){
+		werrstr("se_compile: unclosed (");
+		goto Err;
+	}
+	if(p->nop == 0){
+		werrstr("se_compile: empty template");
+		goto Err;
+	}
+	return p;
+Nomem:
+	werrstr("se_compile: out of memory");
+Err:
+	se_freepat(p);
+	return nil;
+}
+
+void
+se_freepat(Sepat *p)
+{
+	int i;
+
+	if(p == nil)
+		return;
+	for(i = 0; i < p->nop; i++)
+		se_free(p->op[i].lit);
+	free(p->op);
+	free(p);
+}
+
+void
+_se_bindinit(Bind *b, Sepat *p, va_list ap, int own)
+{
+	int i;
+
+	b->pat = p;
+	b->own = own;
+	for(i = 0; i < p->nbind; i++){
+		b->arg[i] = va_arg(ap, void*);
+		b->set[i] = 0;
+	}
+}
+
+/* release values bound for the caller by a match that failed */
+void
+_se_unbind(Bind *b)
+{
+	Pop *o, *eo;
+
+	if(!b->own)
+		return;
+	eo = b->pat->op + b->pat->nop;
+	for(o = b->pat->op; o < eo; o++){
+		if(o->arg < 0 || !b->set[o->arg])
+			continue;
+		switch(o->op){
+		case Pstr:
+			free(*(char**)b->arg[o->arg]);
+			*(char**)b->arg[o->arg] = nil;
+			break;
+		case Pdata:
+			s_free(*(String**)b->arg[o->arg]);
+			*(String**)b->arg[o->arg] = nil;
+			break;
+		case Pany:
+			se_free(*(Sexp**)b->arg[o->arg]);
+			*(Sexp**)b->arg[o->arg] = nil;
+			break;
+		}
+		b->set[o->arg] = 0;
+	}
+}
+
+static int
+atomeq(Sexp *a, Sexp *b)
+{
+	char *pa, *pb;
+	uint na, nb;
+
+	pa = se_atom(a, &na);
+	pb = se_atom(b, &nb);
+	if(na != nb || memcmp(pa, pb, na) != 0)
+		return 0;
+	if(a->hint == nil || b->hint == nil)
+		return a->hint == b->hint;
+	return s_len(a->hint) == s_len(b->hint) && memcmp(s_to_c(a->hint), s_to_c(b->hint), s_len(a->hint)) == 0;
+}
+
+/*
+ * match x against the operations of one item starting at *pc,
+ * leaving *pc after them if it matches
+ */
+int
+_se_matchx(Bind *b, int *pc, Sexp *x)
+{
+	Pop *o;
+	Sexp *l;
+	String *s;
+	char *p;
+	int n;
+
+	o = &b->pat->op[(*pc)++];
+	if(x == nil)
+		return 0;
+	switch(o->op){
+	case Popen:
+		if(x->tag != Slist)
+			return 0;
+		l = x->hd != nil? x: nil;
+		for(;; l = l->tl){
+			o = &b->pat->op[*pc];
+			if(o->op == Prest){
+				*pc += 2;
+				return 1;
+			}
+			if(o->op == Pclose){
+				(*pc)++;
+				return l == nil;
+			}
+			if(l == nil || !_se_matchx(b, pc, l->hd))
+				return 0;
+		}
+	case Plit:
+		return x->tag != Slist && atomeq(x, o->lit);
+	case Pstr:
+		if(x->tag != Sstring)
+			return 0;
+		p = se_atom(x, nil);
+		if(b->own){
+			*(char**)b->arg[o->arg] = strdup(p);
+			b->set[o->arg] = 1;
+		}else
+			*(char**)b->arg[o->arg] = p;
+		return 1;
+	case Pint:
+		if(x->tag != Sstring || se_asint(x, &n) < 0)
+			return 0;
+		*(int*)b->arg[o->arg] = n;
+		return 1;
+	case Pdata:
+		if(x->tag == Slist || (s = se_asdata(x)) == nil)
+			return 0;
+		if(b->own){
+			*(String**)b->arg[o->arg] = s_incref(s);
+			b->set[o->arg] = 1;
+		}else
+			*(String**)b->arg[o->arg] = s;
+		return 1;
+	case Pany:
+		if(b->own){
+			*(Sexp**)b->arg[o->arg] = se_incref(x);
+			b->set[o->arg] = 1;
+		}else
+			*(Sexp**)b->arg[o->arg] = x;
+		return 1;
+	}
+	return 0;
+}
+
+int
+se_match(Sepat *p, Sexp *e, ...)
+{
+	Bind b;
+	va_list ap;
+	int pc;
+
+	va_start(ap, e);
+	_se_bindinit(&b, p, ap, 0);
+	va_end(ap);
+	pc = 0;
+	return _se_matchx(&b, &pc, e);
+}
@@ -0,0 +1,190 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * canonical form of several expressions as a vector of IOchunks:
+ * large atoms are referenced where they lie; everything else
+ * (delimiters, lengths, small atoms) is copied into a scratch buffer,
+ * with adjacent pieces sharing a chunk.
+ * libc's writev gathers the chunks into one buffer before writing,
+ * so se_writev writes them one at a time instead.
+ */
+
+enum{
+	Bigatom=	256,	/* atoms at least this long are referenced, not copied */
+};
+
+typedef struct Vec Vec;
+
+struct Vec {
+	IOchunk*	io;	/* nil when just counting */
+	int	nio;
+	int	aio;
+	uchar*	sp;	/* next free scratch byte */
+	uint	nscratch;	/* scratch used */
+	uint	ascratch;
+	int	last;	/* last chunk is in scratch and ends at sp */
+	int	full;
+};
+
+static void
+put(Vec *v, void *a, uint n)
+{
+	if(n == 0)
+		return;
+	v->nscratch += n;
+	if(v->io == nil || v->full){
+		if(!v->last)
+			v->nio++;
+		v->last = 1;
+		return;
+	}
+	if(v->nscratch > v->ascratch || !v->last && v->nio >= v->aio){
+		v->full = 1;
+		return;
+	}
+	if(!v->last){
+		v->io[v->nio].addr = v->sp;
+		v->io[v->nio].len = 0;
+		v->nio++;
+		v->last = 1;
+	}
+	memmove(v->sp, a, n);
+	v->sp += n;
+	v->io[v->nio-1].len += n;
+}
+
+static void
+ref(Vec *v, void *a, uint n)
+{
+	v->last = 0;
+	if(v->io == nil || v->full){
+		v->nio++;
+		return;
+	}
+	if(v->nio >= v->aio){
+		v->full = 1;
+		return;
+	}
+	v->io[v->nio].addr = a;
+	v->io[v->nio].len = n;
+	v->nio++;
+}
+
+static void
+bytes(Vec *v, uchar *a, uint n)
+{
+	char buf[16];
+
+	put(v, buf, snprint(buf, sizeof buf, "%ud:", n));
+	if(n >= Bigatom)
+		ref(v, a, n);
+	else
+		put(v, a, n);
+}
+
+static void
+packv(Vec *v, Sexp *e)
+{
+	char *p;
+	uint n;
+
+	if(e == nil)
+		return;
+	switch(e->tag){
+	case Sstring:
+	case Sbinary:
+		if(e->hint != nil && s_len(e->hint) != 0){
+			put(v, "[", 1);
+			bytes(v, (uchar*)s_to_c(e->hint), s_len(e->hint));
+			put(v, "]", 1);
+		}
+		p = se_atom(e, &n);
+		bytes(v, (uchar*)p, n);
+		break;
+	case Slist:
+		if(e->pk != nil){
+			if(e->npk >= Bigatom)
+				ref(v, e->pk, e->npk);
+			else
+				put(v, e->pk, e->npk);
+			break;
+		}
+		put(v, "(", 1);
+		do{
+			packv(v, e->hd);
+		}while((e = e->tl) != nil);
+		put(v, ")", 1);
+		break;
+	}
+}
+
+/*
+ * fill io with the canonical forms of the ne expressions in e,
+ * using scratch for all but large atoms.
+ * returns the number of chunks used, or -1 if io or scratch is too small.
+ * if io is nil, returns the number of chunks needed, and sets *nscratch to the scratch needed.
+ */
+int
+se_packv(Sexp **e, int ne, IOchunk *io, int nio, uchar *scratch, uint *nscratch)
+{
+	Vec v;
+	int i;
+
+	memset(&v, 0, sizeof(v));
+	v.io = io;
+	v.aio = nio;
+	v.sp = scratch;
+	v.ascratch = *nscratch;
+	for(i = 0; i < ne; i++)
+		packv(&v, e[i]);
+	if(io == nil){
+		*nscratch = v.nscratch;
+		return v.nio;
+	}
+	if(v.full){
+		werrstr("se_packv: buffer too small");
+		return -1;
+	}
+	*nscratch = v.nscratch;
+	return v.nio;
+}
+
+/*
+ * write the canonical forms of the ne expressions in e to fd, a chunk at a time
+ */
+long
+se_writev(int fd, Sexp **e, int ne)
+{
+	IOchunk *io;
+	uint ns;
+	long n, t;
+	int i, nio;
+
+	ns = 0;
+	nio = se_packv(e, ne, nil, 0, nil, &ns);
+	if(nio == 0)
+		return 0;
+	io = malloc(nio*sizeof(*io) + ns);
+	if(io == nil)
+		return -1;
+	nio = se_packv(e, ne, io, nio, (uchar*)(io+nio), &ns);
+	if(nio < 0){
+		free(io);
+		return -1;
+	}
+	t = 0;
+	for(i = 0; i < nio; i++){
+		n = write(fd, io[i].addr, io[i].len);
+		if(n != io[i].len){
+			free(io);
+			return -1;
+		}
+		t += n;
+	}
+	free(io);
+	return t;
+}
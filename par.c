@@ -0,0 +1,472 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * fork-join versions of se_eq, se_copy, se_free and se_hash for large trees.
+ * the elements of a list that are themselves lists become tasks,
+ * pushed on the deque of the process walking the list, when that deque is nearly empty;
+ * idle processes steal the oldest task of another.
+ * a process waiting for its tasks to finish runs others meanwhile.
+ * everything shared lives in the heap: procs made by rfork have private stacks.
+ */
+
+enum{
+	Nq=	1024,	/* tasks in a deque */
+	Nlazy=	2,	/* push no more than this many */
+	Nserial=	8192,	/* trees with fewer nodes are done by the serial functions */
+	Nspin=	64,	/* looks for work before sleeping */
+
+	/* Task.op */
+	Teq=	0,
+	Tcopy,
+	Tfree,
+	Thash,
+};
+
+typedef struct Join Join;
+typedef struct Task Task;
+typedef struct Worker Worker;
+
+struct Join {
+	long	n;	/* tasks not yet finished */
+};
+
+struct Task {
+	int	op;
+	Sexp*	a;
+	Sexp*	b;	/* Teq: compared with a */
+	Sexp**	out;	/* Tcopy: where the copy goes */
+	Join*	j;
+};
+
+struct Worker {
+	Lock;	/* deque */
+	Task*	q[Nq];
+	long	top;	/* oldest, taken by thieves */
+	long	bot;	/* newest, pushed and popped by the owner */
+	ulong	rand;
+	Sepool*	p;
+};
+
+struct Sepool {
+	Lock;	/* one operation at a time */
+	int	nproc;
+	Worker*	w;	/* w[0] is the caller's */
+	long	queued;	/* tasks in all deques */
+	long	nidle;	/* sleeping on wake */
+	long	wake;
+	long	gone;
+	int	closing;
+	long	differ;	/* se_peq has found a difference */
+};
+
+static void	run(Worker*, Task*);
+
+static int
+push(Worker *w, Task *t)
+{
+	lock(w);
+	if(w->bot - w->top == Nq){
+		unlock(w);
+		return -1;
+	}
+	w->q[w->bot++ % Nq] = t;
+	unlock(w);
+	ainc(&w->p->queued);
+	if(w->p->nidle > 0)
+		semrelease(&w->p->wake, 1);
+	return 0;
+}
+
+static Task*
+pop(Worker *w)
+{
+	Task *t;
+
+	if(w->bot == w->top)
+		return nil;
+	t = nil;
+	lock(w);
+	if(w->bot != w->top)
+		t = w->q[--w->bot % Nq];
+	unlock(w);
+	if(t != nil)
+		adec(&w->p->queued);
+	return t;
+}
+
+static Task*
+steal(Worker *w)
+{
+	Sepool *p;
+	Worker *v;
+	Task *t;
+	int i, k;
+
+	p = w->p;
+	if(p->queued == 0)
+		return nil;
+	w->rand ^= w->rand << 13;
+	w->rand ^= w->rand >> 17;
+	w->rand ^= w->rand << 5;
+	k = w->rand % p->nproc;
+	for(i = 0; i < p->nproc; i++){
+		v = &p->w[(k+i) % p->nproc];
+		if(v == w || v->bot == v->top)
+			continue;
+		t = nil;
+		lock(v);
+		if(v->bot != v->top)
+			t = v->q[v->top++ % Nq];
+		unlock(v);
+		if(t != nil){
+			adec(&p->queued);
+			return t;
+		}
+	}
+	return nil;
+}
+
+/*
+ * hand a to another process if one might take it; 0 if it's the caller's to do.
+ * only lists are worth a task.
+ */
+static int
+spawn(Worker *w, Join **jp, int op, Sexp *a, Sexp *b, Sexp **out)
+{
+	Task *t;
+
+	if(a == nil || a->tag != Slist || w->bot - w->top >= Nlazy)
+		return 0;
+	if(*jp == nil && (*jp = mallocz(sizeof(**jp), 1)) == nil)
+		return 0;
+	t = malloc(sizeof(*t));
+	if(t == nil)
+		return 0;
+	t->op = op;
+	t->a = a;
+	t->b = b;
+	t->out = out;
+	t->j = *jp;
+	ainc(&t->j->n);
+	if(push(w, t) < 0){
+		adec(&t->j->n);
+		free(t);
+		return 0;
+	}
+	return 1;
+}
+
+/* wait for the tasks of j, running any meanwhile */
+static void
+join(Worker *w, Join *j)
+{
+	Task *t;
+
+	if(j == nil)
+		return;
+	while(j->n > 0){
+		t = pop(w);
+		if(t == nil)
+			t = steal(w);
+		if(t != nil)
+			run(w, t);
+		else
+			sleep(0);
+	}
+	free(j);
+}
+
+static int
+peq(Worker *w, Sexp *a, Sexp *b)
+{
+	Join *j;
+	int r;
+
+	if(a == b)
+		return 1;
+	if(a == nil || b == nil || a->tag != b->tag)
+		return 0;
+	if(a->tag != Slist)
+		return se_eq(a, b);
+	j = nil;
+	r = 1;
+	do{
+		if(b == nil || w->p->differ){
+			r = 0;
+			break;
+		}
+		if(!spawn(w, &j, Teq, a->hd, b->hd, nil) && !peq(w, a->hd, b->hd)){
+			r = 0;
+			break;
+		}
+		b = b->tl;
+	}while((a = a->tl) != nil);
+	if(r && a != b)
+		r = 0;
+	if(!r)
+		w->p->differ = 1;
+	join(w, j);
+	return r && !w->p->differ;
+}
+
+/* se_copy, but a list's cells are made in a loop, not by recursion */
+static Sexp*
+pcopy(Worker *w, Sexp *e)
+{
+	Join *j;
+	Sexp *o, **l;
+
+	if(e == nil || e->tag != Slist)
+		return se_copy(e);
+	j = nil;
+	l = &o;
+	for(; e != nil; e = e->tl){
+		*l = se_cons(nil, nil);
+		(*l)->lflag = e->lflag & ~Lcompact;
+		if(!spawn(w, &j, Tcopy, e->hd, nil, &(*l)->hd))
+			(*l)->hd = pcopy(w, e->hd);
+		l = &(*l)->tl;
+	}
+	join(w, j);
+	return o;
+}
+
+/* se_free, likewise */
+static void
+pfree(Worker *w, Sexp *e)
+{
+	Join *j;
+	Sexp *tl;
+
+	if(e == nil || e->tag != Slist || e->inuse < 0 || e->lflag & Lcompact){
+		se_free(e);
+		return;
+	}
+	j = nil;
+	while(e != nil && e->inuse != Sstatic && adec(&e->inuse) == 0){
+		if(!spawn(w, &j, Tfree, e->hd, nil, nil))
+			pfree(w, e->hd);
+		tl = e->tl;
+		free(e->pk);
+		_se_release(e);
+		if(tl != nil && (tl->tag != Slist || tl->inuse < 0 || tl->lflag & Lcompact)){
+			se_free(tl);
+			break;
+		}
+		e = tl;
+	}
+	join(w, j);
+}
+
+/* hashes of the elements, kept in them, so se_hash(e) need only combine them */
+static void
+phash(Worker *w, Sexp *e)
+{
+	Join *j;
+	Sexp *l;
+
+	if(e == nil || e->hash != 0 || e->tag != Slist){
+		se_hash(e);
+		return;
+	}
+	j = nil;
+	for(l = e; l != nil; l = l->tl)
+		if(!spawn(w, &j, Thash, l->hd, nil, nil))
+			phash(w, l->hd);
+	join(w, j);
+	se_hash(e);
+}
+
+static void
+run(Worker *w, Task *t)
+{
+	Join *j;
+
+	switch(t->op){
+	case Teq:
+		if(!w->p->differ && !peq(w, t->a, t->b))
+			w->p->differ = 1;
+		break;
+	case Tcopy:
+		*t->out = pcopy(w, t->a);
+		break;
+	case Tfree:
+		pfree(w, t->a);
+		break;
+	case Thash:
+		phash(w, t->a);
+		break;
+	}
+	j = t->j;
+	free(t);
+	coherence();
+	adec(&j->n);
+}
+
+static void
+loop(Worker *w)
+{
+	Sepool *p;
+	Task *t;
+	int i;
+
+	p = w->p;
+	for(;;){
+		for(i = 0; i < Nspin; i++){
+			t = steal(w);
+			if(t != nil)
+				break;
+			sleep(0);
+		}
+		if(t != nil){
+			run(w, t);
+			continue;
+		}
+		if(p->closing)
+			break;
+		ainc(&p->nidle);
+		if(p->queued == 0 && !p->closing)
+			semacquire(&p->wake, 1);
+		adec(&p->nidle);
+	}
+	semrelease(&p->gone, 1);
+}
+
+static int
+start(Worker *w)
+{
+	switch(rfork(RFPROC|RFMEM|RFNOWAIT)){
+	case -1:
+		return -1;
+	case 0:
+		loop(w);
+		_exits(nil);
+	}
+	return 0;
+}
+
+/* whether e has fewer than n nodes, counting no more than that */
+static int
+small(Sexp *e, long *n)
+{
+	for(; e != nil; e = e->tl){
+		if(--*n <= 0)
+			return 0;
+		if(e->tag != Slist)
+			return 1;
+		if(e->hd != nil && !small(e->hd, n))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+serial(Sepool *p, Sexp *e)
+{
+	long n;
+
+	n = Nserial;
+	return p == nil || p->nproc < 2 || small(e, &n);
+}
+
+/*
+ * a pool of nproc processes, counting the caller, for the functions below
+ */
+Sepool*
+se_poolopen(int nproc)
+{
+	Sepool *p;
+	int i;
+
+	if(nproc < 1)
+		nproc = 1;
+	p = mallocz(sizeof(*p), 1);
+	if(p == nil)
+		return nil;
+	p->w = mallocz(nproc*sizeof(*p->w), 1);
+	if(p->w == nil){
+		free(p);
+		return nil;
+	}
+	for(i = 0; i < nproc; i++){
+		p->w[i].p = p;
+		p->w[i].rand = 2*i+1;
+	}
+	p->nproc = 1;
+	for(i = 1; i < nproc; i++){
+		if(start(&p->w[i]) < 0)
+			break;
+		p->nproc++;
+	}
+	return p;
+}
+
+void
+se_poolclose(Sepool *p)
+{
+	int i;
+
+	if(p == nil)
+		return;
+	p->closing = 1;
+	coherence();
+	semrelease(&p->wake, p->nproc);
+	for(i = 1; i < p->nproc; i++)
+		semacquire(&p->gone, 1);
+	free(p->w);
+	free(p);
+}
+
+int
+se_peq(Sepool *p, Sexp *a, Sexp *b)
+{
+	int r;
+
+	if(serial(p, a))
+		return se_eq(a, b);
+	lock(p);
+	p->differ = 0;
+	r = peq(&p->w[0], a, b);
+	unlock(p);
+	return r;
+}
+
+Sexp*
+se_pcopy(Sepool *p, Sexp *e)
+{
+	Sexp *o;
+
+	if(serial(p, e))
+		return se_copy(e);
+	lock(p);
+	o = pcopy(&p->w[0], e);
+	unlock(p);
+	return o;
+}
+
+void
+se_pfree(Sepool *p, Sexp *e)
+{
+	if(serial(p, e) || e->inuse != 1){
+		se_free(e);
+		return;
+	}
+	lock(p);
+	pfree(&p->w[0], e);
+	unlock(p);
+}
+
+uint
+se_phash(Sepool *p, Sexp *e)
+{
+	if(serial(p, e))
+		return se_hash(e);
+	lock(p);
+	phash(&p->w[0], e);
+	unlock(p);
+	return se_hash(e);
+}
@@ -0,0 +1,98 @@
+#include <u.h>
+#include <libc.h>
+#include <bio.h>
+#include <String.h>
+#include "sexp.h"
+
+/*
+ * s2ctest file: compares testdata, compiled from file by sexp2c,
+ * with file parsed, and checks that the static tree is never changed
+ */
+
+extern Sexp *const testdata;
+
+int	nfail;
+
+void
+check(char *what, char *arg, int ok)
+{
+	print("%s %s: %s\n", what, arg, ok? "ok": "FAIL");
+	if(!ok)
+		nfail++;
+}
+
+/* element i of list e */
+Sexp*
+nth(Sexp *e, int i)
+{
+	for(e = se_els(e); e != nil && i > 0; i--)
+		e = e->tl;
+	return se_hd(e);
+}
+
+/* whether e and the nodes within it are static */
+int
+static1(Sexp *e, void *a)
+{
+	USED(a);
+	return e->inuse == Sstatic? 0: -1;
+}
+
+void
+main(int argc, char **argv)
+{
+	Biobuf *b;
+	Sexp *e, *x, *d, *r;
+	String *s, *t;
+	uchar *p, *q;
+	uint n, m;
+	vlong v, w;
+
+	ARGBEGIN{
+	}ARGEND
+	if(argc != 1){
+		fprint(2, "usage: s2ctest file\n");
+		exits("usage");
+	}
+	b = Bopen(argv[0], OREAD);
+	if(b == nil)
+		sysfatal("can't open %s: %r", argv[0]);
+	e = se_readopt(b, nil, 0, nil);
+	if(e == nil)
+		sysfatal("%s: %r", argv[0]);
+	Bterm(b);
+
+	check("sexp2c", "eq", se_eq(testdata, e) && se_hash(testdata) == se_hash(e));
+	s = se_text(testdata);
+	t = se_text(e);
+	check("sexp2c", "text", strcmp(s_to_c(s), s_to_c(t)) == 0);
+	s_free(s);
+	s_free(t);
+	n = se_packedsize(testdata);
+	m = se_packedsize(e);
+	p = malloc(n);
+	q = malloc(m);
+	check("sexp2c", "pack", n == m && se_pack(p, n, testdata) == n && se_pack(q, m, e) == m &&
+		memcmp(p, q, n) == 0);
+	free(p);
+	free(q);
+	check("sexp2c", "number", se_asvlong(nth(nth(nth(testdata, 2), 1), 1), &v) == 0 &&
+		v == -0x7FFFFFFFFFFFFFFFLL-1 && se_asvlong(nth(nth(testdata, 1), 1), &w) == 0 && w == 3);
+
+	/* incref, free and changes leave the static nodes alone */
+	check("sexp2c", "incref", se_incref(testdata) == testdata && testdata->inuse == Sstatic);
+	se_free(testdata);
+	x = se_unique(testdata);
+	check("sexp2c", "unique", x != nil && x != testdata && x->inuse == 1 && se_eq(x, e));
+	se_free(x);
+	x = se_parse("(policy (version 4))", nil);
+	d = se_diff(testdata, x);
+	r = se_patch(testdata, d);
+	check("sexp2c", "patch", r != nil && se_eq(r, x) && se_eq(testdata, e) &&
+		se_walk(testdata, static1, nil, nil) == 0);
+	se_free(r);
+	se_free(d);
+	se_free(x);
+	se_free(e);
+	exits(nfail? "fail": nil);
+}
@@ -0,0 +1,548 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * find the end of an expression without building it.
+ * the input can be presented in arbitrary pieces:
+ * all state between pieces is kept in the Scan.
+ * the syntax accepted is that of parseitem in sexprs.c,
+ * except that the contents of transport encoding are checked
+ * only when the input is all in one buffer
+ */
+
+enum{
+	Xstart,		/* skipping white space before an item */
+	Xhint,		/* first byte of display hint's string */
+	Xhintend,	/* white space then ] */
+	Xhintval,	/* white space then the hinted string */
+	Xlist,		/* white space then item or ) */
+	Xdec,		/* decimal length prefix */
+	Xverb,		/* n bytes of verbatim data */
+	Xtoken,
+	Xquote,
+	Xesc,		/* byte after \\ */
+	Xoct,		/* n more octal digits */
+	Xhex,		/* n more hex digits */
+	Xb64,		/* |...| */
+	Xb16,		/* #...# */
+	Xtrans,		/* {...} */
+};
+
+static int
+isspace(int c)
+{
+	return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+static int
+istokenc(int c)
+{
+	return c >= '0' && c <= '9' ||
+		c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z' ||
+		c == '-' || c == '.' || c == '/' || c == '_' || c == ':' || c == '*' || c == '+' || c == '=';
+}
+
+static int
+ishex(int c)
+{
+	return c >= '0' && c <= '9' || c >= 'a' && c <= 'f' || c >= 'A' && c <= 'F';
+}
+
+static int
+dec64c(int c)
+{
+	if(c >= 'A' && c <= 'Z')
+		return c-'A';
+	if(c >= 'a' && c <= 'z')
+		return 26+(c-'a');
+	if(c >= '0' && c <= '9')
+		return 52+(c-'0');
+	if(c == '+')
+		return 62;
+	if(c == '/')
+		return 63;
+	return -1;
+}
+
+void
+_se_scaninit(Scan *s)
+{
+	s->state = Xstart;
+	s->depth = 0;
+	s->hint = 0;
+	s->n = 0;
+	s->max = Maxtoken;
+	s->form = Scanonical;
+	s->t0 = nil;
+	s->whole = 0;
+	s->diag = nil;
+}
+
+static int
+err(Scan *s, char *diag)
+{
+	s->diag = diag;
+	return -1;
+}
+
+static void
+advanced(Scan *s)
+{
+	if(s->form == Scanonical)
+		s->form = Sadvanced;
+}
+
+/*
+ * the expression in transport encoding from p to e,
+ * decoded a block at a time into a scan of its own
+ */
+static int
+trans(Scan *s, uchar *p, uchar *e)
+{
+	Scan in;
+	uchar buf[3*64], *o, *b;
+	uint v;
+	int d, k, r;
+
+	_se_scaninit(&in);
+	in.max = s->max;
+	v = 0;
+	k = 0;
+	r = 0;
+	while(p < e && r == 0){
+		for(o = buf; p < e && o+3 <= buf+sizeof(buf); p++){
+			if((d = dec64c(*p)) < 0)
+				continue;
+			v = (v<<6) | d;
+			if(++k == 4){
+				*o++ = v>>16;
+				*o++ = v>>8;
+				*o++ = v;
+				v = 0;
+				k = 0;
+			}
+		}
+		if(p == e && k > 1){
+			v <<= 6*(4-k);
+			*o++ = v>>16;
+			if(k == 3)
+				*o++ = v>>8;
+		}
+		b = buf;
+		r = _se_scan(&in, &b, o);
+	}
+	if(r == 0)
+		r = _se_scanend(&in);
+	if(r > 0)
+		return 0;
+	if(r < 0)
+		return err(s, in.diag);
+	return err(s, "missing expression in transport encoding");
+}
+
+/* first byte of a simple string */
+static int
+simple(Scan *s, int c)
+{
+	if(!(c >= '0' && c <= '9'))
+		advanced(s);
+	if(c >= '0' && c <= '9'){
+		s->state = Xdec;
+		s->n = c-'0';
+	}else if(c == '"')
+		s->state = Xquote;
+	else if(c == '|')
+		s->state = Xb64;
+	else if(c == '#')
+		s->state = Xb16;
+	else if(istokenc(c))
+		s->state = Xtoken;
+	else
+		return err(s, "missing token");
+	return 0;
+}
+
+/* an item has ended; returns 1 if that completes the expression */
+static int
+done(Scan *s)
+{
+	switch(s->hint){
+	case 1:
+		s->state = Xhintend;
+		return 0;
+	case 2:
+		s->hint = 0;
+		break;
+	}
+	if(s->depth == 0){
+		s->state = Xstart;
+		return 1;
+	}
+	s->state = Xlist;
+	return 0;
+}
+
+/*
+ * consume bytes from *pp up to e.
+ * returns 1 and sets *pp just past the end of a complete expression,
+ * 0 if all bytes were consumed and more are needed,
+ * or -1 on a syntax error, with *pp at the offending byte.
+ * a token at the outer level ends only at the following delimiter,
+ * which is not consumed.
+ */
+int
+_se_scan(Scan *s, uchar **pp, uchar *e)
+{
+	uchar *p;
+	long m;
+	int c;
+
+	for(p = *pp; p < e; p++){
+		c = *p;
+	Again:
+		switch(s->state){
+		case Xstart:
+			if(isspace(c)){
+				if(s->depth > 0 || s->hint)
+					advanced(s);
+				break;
+			}
+			switch(c){
+			case '(':
+				s->depth++;
+				s->state = Xlist;
+				break;
+			case '{':
+				if(s->depth == 0 && s->hint == 0)
+					s->form = Stransport;
+				else
+					advanced(s);
+				s->t0 = p+1;
+				s->state = Xtrans;
+				break;
+			case '[':
+				s->hint = 1;
+				s->state = Xhint;
+				break;
+			default:
+				if(simple(s, c) < 0)
+					goto Err;
+			}
+			break;
+		case Xlist:
+			if(isspace(c)){
+				advanced(s);
+				break;
+			}
+			if(c == ')'){
+				s->depth--;
+				if(done(s))
+					goto Done;
+				break;
+			}
+			s->state = Xstart;
+			goto Again;
+		case Xhint:
+			if(simple(s, c) < 0)
+				goto Err;
+			break;
+		case Xhintend:
+			if(isspace(c)){
+				advanced(s);
+				break;
+			}
+			if(c != ']'){
+				err(s, "missing ] in display hint");
+				goto Err;
+			}
+			s->hint = 2;
+			s->state = Xhintval;
+			break;
+		case Xhintval:
+			if(isspace(c)){
+				advanced(s);
+				break;
+			}
+			if(simple(s, c) < 0)
+				goto Err;
+			break;
+		case Xdec:
+			if(c >= '0' && c <= '9'){
+				if(s->n <= s->max)
+					s->n = s->n*10 + c-'0';
+				break;
+			}
+			if(s->n > s->max && (c == ':' || c == '"' || c == '|' || c == '#')){
+				err(s, "implausible token length");
+				goto Err;
+			}
+			if(c != ':')
+				advanced(s);
+			switch(c){
+			case ':':
+				s->state = Xverb;
+				if(s->n == 0 && done(s))
+					goto Done;
+				break;
+			case '"':
+				s->state = Xquote;
+				break;
+			case '|':
+				s->state = Xb64;
+				break;
+			case '#':
+				s->state = Xb16;
+				break;
+			default:
+				if(RIVEST){
+					err(s, "token can't start with a digit");
+					goto Err;
+				}
+				s->state = Xtoken;
+				goto Again;
+			}
+			break;
+		case Xverb:
+			m = e-p;
+			if(m > s->n)
+				m = s->n;
+			p += m-1;
+			s->n -= m;
+			if(s->n == 0 && done(s))
+				goto Done;
+			break;
+		case Xtoken:
+			if(istokenc(c))
+				break;
+			if(done(s)){
+				*pp = p;	/* delimiter isn't part of it */
+				return 1;
+			}
+			goto Again;
+		case Xquote:
+			while(c != '"' && c != '\\'){
+				if(++p == e)
+					goto More;
+				c = *p;
+			}
+			if(c == '\\')
+				s->state = Xesc;
+			else if(done(s))
+				goto Done;
+			break;
+		case Xesc:
+			s->state = Xquote;
+			if(c >= '0' && c <= '7'){
+				s->state = Xoct;
+				s->n = 2;
+			}else if(c == 'x'){
+				s->state = Xhex;
+				s->n = 2;
+			}
+			break;
+		case Xoct:
+			if(!(c >= '0' && c <= '7')){
+				err(s, "illegal octal escape");
+				goto Err;
+			}
+			if(--s->n == 0)
+				s->state = Xquote;
+			break;
+		case Xhex:
+			if(!ishex(c)){
+				err(s, "illegal hex escape");
+				goto Err;
+			}
+			if(--s->n == 0)
+				s->state = Xquote;
+			break;
+		case Xb64:
+		case Xb16:
+		case Xtrans:
+			m = s->state == Xb64? '|': s->state == Xb16? '#': '}';
+			p = memchr(p, m, e-p);
+			if(p == nil)
+				goto More;
+			if(s->state == Xtrans && s->whole && trans(s, s->t0, p) < 0){
+				p = s->t0-1;
+				goto Err;
+			}
+			if(done(s))
+				goto Done;
+			break;
+		}
+	}
+More:
+	*pp = e;
+	return 0;
+Done:
+	*pp = p+1;
+	return 1;
+Err:
+	*pp = p;
+	return -1;
+}
+
+/*
+ * at end of input, returns 1 if the input scanned so far is a complete expression
+ * (an outer-level token lacking a delimiter),
+ * 0 if there was nothing but white space, and -1 otherwise.
+ */
+int
+_se_scanend(Scan *s)
+{
+	if(s->depth == 0 && s->hint == 0){
+		switch(s->state){
+		case Xstart:
+			return 0;
+		case Xtoken:
+		case Xdec:
+			advanced(s);
+			s->state = Xstart;
+			return 1;
+		}
+	}
+	s->diag = "incomplete expression";
+	return -1;
+}
+
+/*
+ * canonical form only: lists, verbatim atoms and display hints, without white space.
+ * returns 1 with *pp just past the expression, 0 if it is incomplete,
+ * or -1 with *pp at the first byte that isn't canonical, or is wrong
+ */
+static int
+canon(uchar *p, uchar *e, uchar **pp)
+{
+	int depth, hint, c;
+	uvlong n;
+
+	depth = 0;
+	hint = 0;	/* as in Scan */
+	for(;;){
+		if(p == e){
+			*pp = p;
+			return 0;
+		}
+		c = *p;
+		if(c >= '0' && c <= '9'){
+			n = 0;
+			do{
+				if(n <= Maxatom)
+					n = n*10 + c-'0';
+				if(++p == e){
+					*pp = p;
+					return 0;
+				}
+				c = *p;
+			}while(c >= '0' && c <= '9');
+			if(c != ':' || n > Maxatom){
+				*pp = p;
+				return -1;
+			}
+			p++;
+			if(n > e-p){
+				*pp = e;
+				return 0;
+			}
+			p += n;
+			if(hint == 1){
+				if(p == e){
+					*pp = p;
+					return 0;
+				}
+				if(*p != ']'){
+					*pp = p;
+					return -1;
+				}
+				p++;
+				hint = 2;
+				continue;
+			}
+			hint = 0;
+			if(depth == 0){
+				*pp = p;
+				return 1;
+			}
+			continue;
+		}
+		if(hint == 0){
+			switch(c){
+			case '(':
+				depth++;
+				p++;
+				continue;
+			case ')':
+				if(depth == 0)
+					break;
+				p++;
+				if(--depth == 0){
+					*pp = p;
+					return 1;
+				}
+				continue;
+			case '[':
+				hint = 1;
+				p++;
+				continue;
+			}
+		}
+		*pp = p;
+		return -1;
+	}
+}
+
+/*
+ * find the end of the first expression in buf and check its syntax,
+ * without building it or allocating anything.
+ * returns its form, Scanonical, Sadvanced or Stransport, with *end just past it;
+ * 0 if buf holds only white space, or (with Smore) the start of an expression,
+ * with *end at its start; or -1 on error, with *end at the offending byte.
+ */
+int
+se_scan(char *buf, uint n, char **end, int flags)
+{
+	Scan s;
+	uchar *p, *e, *q;
+	int r;
+
+	p = (uchar*)buf;
+	e = p+n;
+	while(p < e && isspace(*p))
+		p++;
+	r = canon(p, e, &q);
+	if(r > 0){
+		*end = (char*)q;
+		return Scanonical;
+	}
+	if(flags & Sonlycanon){
+		if(r == 0 && (flags & Smore || p == e)){
+			*end = (char*)p;
+			return 0;
+		}
+		*end = (char*)q;
+		werrstr("se_scan: %s at offset %lld", r == 0? "incomplete expression": "not canonical form", (vlong)(q-(uchar*)buf));
+		return -1;
+	}
+	_se_scaninit(&s);
+	s.max = Maxatom;
+	s.whole = 1;
+	q = p;
+	r = _se_scan(&s, &q, e);
+	if(r == 0 && (flags & Smore) == 0)
+		r = _se_scanend(&s);
+	if(r < 0){
+		*end = (char*)q;
+		werrstr("se_scan: %s at offset %lld", s.diag, (vlong)(q-(uchar*)buf));
+		return -1;
+	}
+	if(r == 0){
+		*end = (char*)p;
+		return 0;
+	}
+	*end = (char*)q;
+	return s.form;
+}
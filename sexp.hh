@@ -0,0 +1,200 @@
+/*
+ * C++ binding for sexp.h, in this header only.
+ * include <u.h> and <libc.h> first.
+ *
+ * Ref owns a reference: moving one transfers it without touching the count,
+ * and only Ref::share and Ref::copy add references.
+ * View borrows: it costs a pointer, and is valid while some Ref (or the C code) holds the tree.
+ * ranges over a list's elements, atoms as std::string_view, and Builder::push(Ref&&)
+ * and Builder::data(Buffer&&) hand over what they are given without copying.
+ * errors are reported as in C: an empty Ref, or false, with the system error string set.
+ */
+
+#ifndef SEXP_HH
+#define SEXP_HH
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+extern "C" {
+typedef struct String String;
+#include "sexp.h"
+}
+
+namespace sexp {
+
+class Iter;
+
+class View {
+protected:
+	Sexp*	e;
+public:
+	View(Sexp *x = nullptr) noexcept : e(x) {}
+	Sexp*	get() const noexcept { return e; }
+	explicit operator bool() const noexcept { return e != nullptr; }
+
+	bool	islist() const noexcept { return e != nullptr && e->tag == Slist; }
+	bool	isatom() const noexcept { return e != nullptr && e->tag != Slist; }
+	bool	istext() const noexcept { return e != nullptr && e->tag == Sstring; }
+
+	/* value of an atom; empty for a list */
+	std::string_view	atom() const noexcept {
+		uint n;
+		char *p = se_atom(e, &n);
+		return p != nullptr? std::string_view(p, n): std::string_view();
+	}
+	bool	asint(int &v) const noexcept { return se_asint(e, &v) == 0; }
+	bool	asvlong(vlong &v) const noexcept { return se_asvlong(e, &v) == 0; }
+
+	/* list operations, empty when not applicable */
+	View	hd() const noexcept { return islist()? View(e->hd): View(); }
+	View	tl() const noexcept { return islist()? View(e->tl): View(); }
+	std::string_view	op() const noexcept { return hd().istext()? hd().atom(): std::string_view(); }
+	int	len() const noexcept { return se_len(e); }
+	View	operator[](int i) const noexcept;
+	Iter	begin() const noexcept;
+	Iter	end() const noexcept;
+
+	bool	operator==(View o) const noexcept { return se_eq(e, o.e) != 0; }
+	bool	operator!=(View o) const noexcept { return se_eq(e, o.e) == 0; }
+	uint	hash() const noexcept { return se_hash(e); }
+
+	/* canonical form */
+	std::string	packed() const {
+		std::string s;
+		if(e != nullptr){
+			s.resize(se_packedsize(e));
+			se_pack(reinterpret_cast<uchar*>(&s[0]), s.size(), e);
+		}
+		return s;
+	}
+};
+
+/* the elements of a list, in order */
+class Iter {
+	Sexp*	l;
+public:
+	explicit Iter(Sexp *x) noexcept : l(x) {}
+	View	operator*() const noexcept { return View(l->hd); }
+	Iter&	operator++() noexcept { l = l->tl; return *this; }
+	bool	operator==(const Iter &o) const noexcept { return l == o.l; }
+	bool	operator!=(const Iter &o) const noexcept { return l != o.l; }
+};
+
+inline Iter
+View::begin() const noexcept
+{
+	return Iter(islist() && e->hd != nullptr? e: nullptr);
+}
+
+inline Iter
+View::end() const noexcept
+{
+	return Iter(nullptr);
+}
+
+inline View
+View::operator[](int i) const noexcept
+{
+	for(View x : *this)
+		if(i-- == 0)
+			return x;
+	return View();
+}
+
+class Ref : public View {
+public:
+	Ref() noexcept {}
+	explicit Ref(Sexp *x) noexcept : View(x) {}	/* adopts x's reference */
+	Ref(Ref &&o) noexcept : View(o.release()) {}
+	Ref(const Ref&) = delete;
+	~Ref() { se_free(e); }
+
+	Ref&	operator=(Ref &&o) noexcept {
+		if(this != &o){
+			se_free(e);
+			e = o.release();
+		}
+		return *this;
+	}
+	Ref&	operator=(const Ref&) = delete;
+
+	/* give up the reference, to C code that takes it */
+	Sexp*	release() noexcept { Sexp *x = e; e = nullptr; return x; }
+	void	reset(Sexp *x = nullptr) noexcept { se_free(e); e = x; }
+
+	/* another reference to the same tree, and a copy of it */
+	static Ref	share(View v) noexcept { return Ref(se_incref(v.get())); }
+	Ref	share() const noexcept { return Ref(se_incref(e)); }
+	Ref	copy() const noexcept { return Ref(se_copy(e)); }
+
+	static Ref	str(const char *s) noexcept { return Ref(se_str(const_cast<char*>(s))); }
+	static Ref	data(const void *a, uint n) noexcept { return Ref(se_data(static_cast<uchar*>(const_cast<void*>(a)), n)); }
+	static Ref	num(vlong v) noexcept { return Ref(se_vlong(v)); }
+	static Ref	parse(std::string_view s, const char **end = nullptr) noexcept {
+		char *ep;
+		Ref r(se_unpack(const_cast<char*>(s.data()), s.size(), &ep));
+		if(end != nullptr)
+			*end = ep;
+		return r;
+	}
+};
+
+/* bytes from malloc, passed to a Builder without copying */
+class Buffer {
+	uchar*	p;
+	uint	n;
+public:
+	explicit Buffer(uint size) noexcept : p(static_cast<uchar*>(malloc(size))), n(p != nullptr? size: 0) {}
+	Buffer(Buffer &&o) noexcept : p(o.p), n(o.n) { o.p = nullptr; o.n = 0; }
+	Buffer(const Buffer&) = delete;
+	~Buffer() { free(p); }
+	Buffer&	operator=(Buffer &&o) noexcept {
+		if(this != &o){
+			free(p);
+			p = o.p;
+			n = o.n;
+			o.p = nullptr;
+			o.n = 0;
+		}
+		return *this;
+	}
+	uchar*	data() noexcept { return p; }
+	uint	size() const noexcept { return n; }
+	uchar*	release() noexcept { uchar *x = p; p = nullptr; n = 0; return x; }
+};
+
+/* se_builder and friends, which accept the nil builder se_builder gives when out of memory */
+class Builder {
+	Sebuild*	b;
+public:
+	Builder() noexcept : b(se_builder()) {}
+	Builder(Builder &&o) noexcept : b(o.b) { o.b = nullptr; }
+	Builder(const Builder&) = delete;
+	~Builder() { if(b != nullptr) se_free(se_finish(b)); }
+
+	bool	push(Ref &&e) noexcept { return se_push(b, e.release()) == 0; }
+	bool	push(View e) noexcept { return se_push(b, se_incref(e.get())) == 0; }
+	bool	data(Buffer &&a) noexcept { uint n = a.size(); return se_pushdata(b, a.release(), n) == 0; }
+	/* copies s, since a string_view owns nothing to hand over */
+	bool	str(std::string_view s) noexcept {
+		char *p = static_cast<char*>(malloc(s.size()+1));
+		if(p == nullptr)
+			return se_push(b, nullptr) == 0;	/* records the failure */
+		memcpy(p, s.data(), s.size());
+		p[s.size()] = 0;
+		return se_pushstr(b, p) == 0;
+	}
+	bool	open() noexcept { return se_open(b) == 0; }
+	bool	close() noexcept { return se_close(b) == 0; }
+
+	/* the result; the builder can't be used again */
+	Ref	finish() noexcept { Sebuild *x = b; b = nullptr; return Ref(se_finish(x)); }
+};
+
+}	/* namespace sexp */
+
+#endif
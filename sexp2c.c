@@ -0,0 +1,201 @@
+#include <u.h>
+#include <libc.h>
+#include <bio.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * sexp2c name [file]
+ * write C source for the S-expression in file as statically initialised nodes,
+ * read-only and never freed, and a pointer name to it.
+ * everything the library would otherwise compute and keep in a node on first use
+ * (hash, numeric value, atom String) is filled in here, so the nodes are never written.
+ */
+
+Biobuf	out;
+int	nnode;
+int	natom;
+
+static void
+usage(void)
+{
+	fprint(2, "usage: sexp2c name [file]\n");
+	exits("usage");
+}
+
+static int
+isspace(int c)
+{
+	return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+static int
+isident(char *s)
+{
+	if(*s == 0 || *s >= '0' && *s <= '9')
+		return 0;
+	for(; *s != 0; s++)
+		if(!(*s >= 'a' && *s <= 'z' || *s >= 'A' && *s <= 'Z' || *s >= '0' && *s <= '9' || *s == '_'))
+			return 0;
+	return 1;
+}
+
+/* n bytes as a C string literal, in lines */
+static void
+literal(uchar *p, uint n)
+{
+	uint i;
+	int c;
+
+	Bprint(&out, "\t\"");
+	for(i = 0; i < n; i++){
+		if(i > 0 && i%64 == 0)
+			Bprint(&out, "\"\n\t\"");
+		c = p[i];
+		if(c >= ' ' && c < 0x7F && c != '"' && c != '\\' && c != '?')	/* ? could start a trigraph */
+			Bputc(&out, c);
+		else
+			Bprint(&out, "\\%.3o", c);
+	}
+	Bprint(&out, "\"");
+}
+
+/* a String holding a copy of the n bytes at p, null-terminated */
+static int
+string(char *p, uint n)
+{
+	int k;
+
+	k = natom++;
+	Bprint(&out, "static const char a%d[] =\n", k);
+	literal((uchar*)p, n);
+	Bprint(&out, ";\nstatic String s%d = {.base=(char*)a%d, .end=(char*)a%d+%ud, .ptr=(char*)a%d+%ud, .ref=1, .fixed=1};\n",
+		k, k, k, n+1, k, n);
+	return k;
+}
+
+static int
+atom(Sexp *e)
+{
+	char *p;
+	uint n;
+	int k, s, h;
+	vlong v;
+
+	p = se_atom(e, &n);
+	if(p == nil)
+		sysfatal("atom: %r");
+	s = string(p, n);
+	h = -1;
+	if(e->hint != nil)
+		h = string(s_to_c(e->hint), s_len(e->hint));
+	se_asvlong(e, &v);	/* settles Anum or Anotnum, unless out of range */
+	k = nnode++;
+	Bprint(&out, "static const Sexp n%d = {.inuse=Sstatic, .tag=%s, .hash=%udU, .s=&s%d",
+		k, e->tag == Sstring? "Sstring": "Sbinary", se_hash(e), s);
+	if(h >= 0)
+		Bprint(&out, ", .hint=&s%d", h);
+	if(e->aflag & Anum)
+		Bprint(&out, ", .num=%lldLL", e->num);
+	Bprint(&out, ", .aflag=%d};\n\n", e->aflag & (Anum|Anotnum));
+	return k;
+}
+
+/*
+ * the nodes of e, leaves first, returning the number of e's own node.
+ * the cells of a list are done from the last, without recursion
+ */
+static int
+node(Sexp *e)
+{
+	Sexp *l, **cell;
+	int n, i, k, hd;
+
+	if(e->tag != Slist)
+		return atom(e);
+	n = 0;
+	for(l = e; l != nil; l = l->tl)
+		n++;
+	cell = malloc(n*sizeof(*cell));
+	if(cell == nil)
+		sysfatal("out of memory");
+	n = 0;
+	for(l = e; l != nil; l = l->tl)
+		cell[n++] = l;
+	k = -1;
+	for(i = n-1; i >= 0; i--){
+		l = cell[i];
+		hd = l->hd != nil? node(l->hd): -1;
+		Bprint(&out, "static const Sexp n%d = {.inuse=Sstatic, .tag=Slist, .hash=%udU", nnode, se_hash(l));
+		if(hd >= 0)
+			Bprint(&out, ", .hd=(Sexp*)&n%d", hd);
+		if(k >= 0)
+			Bprint(&out, ", .tl=(Sexp*)&n%d", k);
+		Bprint(&out, "};\n");
+		k = nnode++;
+	}
+	Bprint(&out, "\n");
+	free(cell);
+	return k;
+}
+
+void
+main(int argc, char **argv)
+{
+	char *buf, *end, *name, *file, *p;
+	long abuf, nbuf, n;
+	int fd, root;
+	Sexp *e;
+
+	ARGBEGIN{
+	default:
+		usage();
+	}ARGEND
+	if(argc < 1 || argc > 2)
+		usage();
+	name = argv[0];
+	if(!isident(name))
+		sysfatal("%s: not a C identifier", name);
+	file = "stdin";
+	fd = 0;
+	if(argc > 1){
+		file = argv[1];
+		fd = open(file, OREAD);
+		if(fd < 0)
+			sysfatal("can't open %s: %r", file);
+	}
+
+	abuf = 8192;
+	nbuf = 0;
+	buf = malloc(abuf);
+	for(;;){
+		if(buf == nil)
+			sysfatal("out of memory");
+		n = read(fd, buf+nbuf, abuf-nbuf);
+		if(n < 0)
+			sysfatal("%s: read error: %r", file);
+		if(n == 0)
+			break;
+		nbuf += n;
+		if(nbuf == abuf){
+			abuf *= 2;
+			buf = realloc(buf, abuf);
+		}
+	}
+	e = se_unpack(buf, nbuf, &end);
+	if(e == nil)
+		sysfatal("%s: %r (offset %lld)", file, (vlong)(end-buf));
+	for(p = end; p < buf+nbuf; p++)
+		if(!isspace(*p))
+			sysfatal("%s: more than one expression (offset %lld)", file, (vlong)(p-buf));
+
+	Binit(&out, 1, OWRITE);
+	Bprint(&out, "/* made by sexp2c from %s; do not edit */\n", file);
+	Bprint(&out, "#include <u.h>\n#include <libc.h>\n#include <String.h>\n#include <sexp.h>\n\n");
+	root = node(e);
+	Bprint(&out, "Sexp *const %s = (Sexp*)&n%d;\n", name, root);
+	if(Bterm(&out) < 0)
+		sysfatal("write error: %r");
+	exits(nil);
+}
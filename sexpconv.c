@@ -0,0 +1,406 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+
+/*
+ * sexpconv [-act] [-su] [-p nproc] [-m maxatom]
+ * convert a stream of S-expressions between advanced, canonical and transport forms.
+ * input is split into expressions by se_scan, without parsing,
+ * and batches of them are converted by nproc processes, and written in order.
+ * canonical and transport expressions wanted in the same form are copied, not parsed;
+ * advanced output is always made afresh, since advanced input may hold verbatim atoms.
+ */
+
+enum{
+	Nread=	64*1024,	/* bytes read at once */
+	Njob=	256*1024,	/* input bytes converted as a batch */
+	Nframe=	4096,	/* expressions in a batch */
+};
+
+typedef struct Frame Frame;
+typedef struct Job Job;
+
+struct Frame {
+	long	off;
+	long	len;
+	int	form;
+};
+
+struct Job {
+	uchar*	in;
+	long	nin;
+	long	ain;
+	Frame	f[Nframe];
+	int	nf;
+	uchar*	out;
+	long	nout;
+	long	aout;
+	uchar*	tmp;	/* canonical form for transport output */
+	long	atmp;
+	char	err[ERRMAX];
+	int	last;	/* no more jobs follow */
+	long	full;	/* input ready for a worker */
+	long	done;	/* output ready for the writer */
+	long	free;	/* can be filled again */
+};
+
+int	outform = Scanonical;
+Seopt	opt;
+Job*	job;
+int	njob;
+long	seq;	/* next job for a worker */
+long	fin;
+int	failed;
+vlong	nin;
+vlong	nout;
+vlong	nexpr;
+
+static void
+usage(void)
+{
+	fprint(2, "usage: sexpconv [-act] [-su] [-p nproc] [-m maxatom]\n");
+	exits("usage");
+}
+
+static int
+isspace(int c)
+{
+	return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+static void*
+grow(void *p, long *ap, long n)
+{
+	if(n <= *ap)
+		return p;
+	if(n < 2 * *ap)
+		n = 2 * *ap;
+	p = realloc(p, n);
+	if(p == nil)
+		sysfatal("out of memory");
+	*ap = n;
+	return p;
+}
+
+static void
+put(Job *j, void *a, long n)
+{
+	j->out = grow(j->out, &j->aout, j->nout+n);
+	memmove(j->out+j->nout, a, n);
+	j->nout += n;
+}
+
+/* canonical form of the expression at a, in j->tmp unless already canonical */
+static uchar*
+canonical(Job *j, Frame *f, uchar *a, long *np)
+{
+	Sexp *e;
+	uint n;
+
+	if(f->form == Scanonical){
+		*np = f->len;
+		return a;
+	}
+	e = se_unpackopt((char*)a, f->len, nil, &opt);
+	if(e == nil)
+		return nil;
+	n = se_packedsize(e);
+	j->tmp = grow(j->tmp, &j->atmp, n);
+	se_pack(j->tmp, n, e);
+	se_free(e);
+	*np = n;
+	return j->tmp;
+}
+
+static int
+conv1(Job *j, Frame *f)
+{
+	uchar *a, *c;
+	long n;
+	Sexp *e;
+	String *s;
+
+	a = j->in + f->off;
+	switch(outform){
+	case Scanonical:
+		c = canonical(j, f, a, &n);
+		if(c == nil)
+			return -1;
+		put(j, c, n);
+		break;
+	case Stransport:
+		if(f->form == Stransport){
+			put(j, a, f->len);
+			put(j, "\n", 1);
+			break;
+		}
+		c = canonical(j, f, a, &n);
+		if(c == nil)
+			return -1;
+		j->out = grow(j->out, &j->aout, j->nout + 4*(n+2)/3 + 4);
+		j->out[j->nout++] = '{';
+		j->nout += enc64((char*)j->out+j->nout, j->aout-j->nout, c, n);
+		j->out[j->nout++] = '}';
+		j->out[j->nout++] = '\n';
+		break;
+	case Sadvanced:
+		e = se_unpackopt((char*)a, f->len, nil, &opt);
+		if(e == nil)
+			return -1;
+		s = se_text(e);
+		se_free(e);
+		if(s == nil)
+			return -1;
+		put(j, s_to_c(s), s_len(s));
+		put(j, "\n", 1);
+		s_free(s);
+		break;
+	}
+	return 0;
+}
+
+static void
+conv(Job *j)
+{
+	int i;
+
+	j->nout = 0;
+	j->err[0] = 0;
+	for(i = 0; i < j->nf; i++)
+		if(conv1(j, &j->f[i]) < 0){
+			rerrstr(j->err, sizeof(j->err));
+			if(j->err[0] == 0)
+				strcpy(j->err, "conversion failed");
+			return;
+		}
+}
+
+static void
+output(Job *j)
+{
+	if(failed)
+		return;
+	if(j->err[0] != 0){
+		fprint(2, "sexpconv: %s\n", j->err);
+		failed = 1;
+		return;
+	}
+	if(write(1, j->out, j->nout) != j->nout){
+		fprint(2, "sexpconv: write error: %r\n");
+		failed = 1;
+		return;
+	}
+	nout += j->nout;
+}
+
+static void
+worker(void)
+{
+	Job *j;
+
+	for(;;){
+		j = &job[(ainc(&seq)-1) % njob];
+		semacquire(&j->full, 1);
+		if(!j->last)
+			conv(j);
+		semrelease(&j->done, 1);
+		if(j->last)
+			return;
+	}
+}
+
+static void
+writer(void)
+{
+	Job *j;
+	int i;
+
+	for(i = 0;; i = (i+1) % njob){
+		j = &job[i];
+		semacquire(&j->done, 1);
+		if(j->last)
+			break;
+		output(j);
+		semrelease(&j->free, 1);
+	}
+	semrelease(&fin, 1);
+}
+
+static void
+spawn(void (*f)(void))
+{
+	switch(rfork(RFPROC|RFMEM|RFNOWAIT)){
+	case -1:
+		sysfatal("rfork: %r");
+	case 0:
+		f();
+		exits(nil);
+	}
+}
+
+/*
+ * the next job to fill, in order; with no workers, the only one
+ */
+static Job*
+next(int nproc)
+{
+	static int n;
+	Job *j;
+
+	j = &job[n];
+	if(nproc > 1){
+		n = (n+1) % njob;
+		semacquire(&j->free, 1);
+	}
+	j->nin = 0;
+	j->nf = 0;
+	j->last = 0;
+	return j;
+}
+
+/* hand a full job to the workers, or convert it here */
+static void
+submit(Job *j, int nproc)
+{
+	if(nproc > 1){
+		semrelease(&j->full, 1);
+		return;
+	}
+	conv(j);
+	output(j);
+}
+
+void
+main(int argc, char **argv)
+{
+	uchar *buf;
+	char *end, *s;
+	long abuf, nbuf, off, n;
+	int nproc, stats, eof, r, i;
+	vlong t0, t;
+	Job *j;
+	Frame *f;
+
+	nproc = 1;
+	if((s = getenv("NPROC")) != nil){
+		nproc = atoi(s);
+		free(s);
+	}
+	stats = 0;
+	ARGBEGIN{
+	case 'a':
+		outform = Sadvanced;
+		break;
+	case 'c':
+		outform = Scanonical;
+		break;
+	case 't':
+		outform = Stransport;
+		break;
+	case 's':
+		stats = 1;
+		break;
+	case 'u':
+		opt.utf8 = 1;
+		break;
+	case 'p':
+		nproc = atoi(EARGF(usage()));
+		break;
+	case 'm':
+		opt.maxatom = strtoll(EARGF(usage()), nil, 0);
+		break;
+	default:
+		usage();
+	}ARGEND
+	if(argc != 0)
+		usage();
+	if(nproc < 1)
+		nproc = 1;
+
+	njob = nproc > 1? 2*nproc: 1;
+	job = mallocz(njob*sizeof(*job), 1);
+	if(job == nil)
+		sysfatal("out of memory");
+	for(i = 0; i < njob; i++)
+		job[i].free = 1;
+	if(nproc > 1){
+		for(i = 0; i < nproc; i++)
+			spawn(worker);
+		spawn(writer);
+	}
+
+	t0 = nsec();
+	abuf = Nread;
+	buf = malloc(abuf);
+	if(buf == nil)
+		sysfatal("out of memory");
+	nbuf = 0;
+	off = 0;
+	eof = 0;
+	j = next(nproc);
+	while(!failed){
+		while(off < nbuf && isspace(buf[off]))
+			off++;	/* between expressions */
+		r = se_scan((char*)buf+off, nbuf-off, &end, eof? 0: Smore);
+		if(r < 0){
+			fprint(2, "sexpconv: %r (input offset %lld)\n", nin - (nbuf - ((uchar*)end-buf)));
+			failed = 1;
+			break;
+		}
+		if(r == 0){
+			if(eof)
+				break;
+			/* keep the partial expression, and read more */
+			off = (uchar*)end - buf;
+			memmove(buf, buf+off, nbuf-off);
+			nbuf -= off;
+			off = 0;
+			buf = grow(buf, &abuf, nbuf+Nread);
+			n = read(0, buf+nbuf, abuf-nbuf);
+			if(n < 0)
+				sysfatal("read error: %r");
+			if(n == 0)
+				eof = 1;
+			nbuf += n;
+			nin += n;
+			continue;
+		}
+		n = (uchar*)end - (buf+off);
+		if(j->nf == Nframe || j->nin > 0 && j->nin+n > Njob){
+			submit(j, nproc);
+			j = next(nproc);
+		}
+		j->in = grow(j->in, &j->ain, j->nin+n);
+		memmove(j->in+j->nin, buf+off, n);
+		f = &j->f[j->nf++];
+		f->off = j->nin;
+		f->len = n;
+		f->form = r;
+		j->nin += n;
+		nexpr++;
+		off += n;
+	}
+	if(j->nf > 0)
+		submit(j, nproc);
+	if(nproc > 1){
+		/* one last job for each worker, the first of which stops the writer */
+		if(j->nf > 0)
+			j = next(nproc);
+		for(i = 0; i < nproc; i++){
+			j->last = 1;
+			semrelease(&j->full, 1);
+			if(i+1 < nproc)
+				j = next(nproc);
+		}
+		semacquire(&fin, 1);
+	}
+	if(stats){
+		t = nsec() - t0;
+		if(t <= 0)
+			t = 1;
+		fprint(2, "sexpconv: %lld expressions, %lld bytes in, %lld bytes out, %d procs, %.3fs, %.1f MB/s\n",
+			nexpr, nin, nout, nproc, t/1e9, nin/1e6/(t/1e9));
+	}
+	exits(failed? "errors": nil);
+}
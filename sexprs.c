@@ -3,6 +3,7 @@
 #include <bio.h>
 #include <String.h>
 #include "sexp.h"
+#include "impl.h"
 
 /*
  * full SDSI/SPKI S-expression reader
@@ -12,44 +13,138 @@
  */
 
 enum{
-	Maxtoken=	1024*1024,	/* should be more than enough */
-	RIVEST=	0,		/* don't enforce Rivest's s-expr requirement that tokens can't start with digits */
-
 	Here=	-1,
+	Nblk=	3*256,	/* bytes of transport encoding decoded at once */
+	Mincache=	64,	/* smallest canonical form worth keeping */
+	Nbig=	8*1024,	/* bytes of a big atom moved at once */
+	Maxdepth=	256,	/* lists and transport encodings open at once */
+	Nerrlab=	2*Maxdepth+8,
 };
 
+
 #define	waserror()	(rd->nerrlab++, setjmp(rd->errlab[rd->nerrlab-1]))
 #define	nexterror()	longjmp(rd->errlab[--rd->nerrlab], 1);
 #define	poperror()	rd->nerrlab--
 
 typedef struct Rd Rd;
-struct Rd {
+typedef struct Src Src;
+typedef struct Tl Tl;
+
+struct Src {
 	Biobuf*	t;
 	uchar*	base;
 	uchar*	p;
 	uchar*	end;
+	Tl*	tl;	/* transport encoding supplying base to end, or nil */
+};
+
+/*
+ * base64 transport encoding {...}, decoded a block at a time
+ * as the parser consumes it
+ */
+struct Tl {
+	Src	src;	/* encoded data */
+	int	eof;	/* closing } seen */
+	vlong	off;	/* offset of buf[0] in decoded data */
+	uchar	buf[1+Nblk];	/* buf[0] is the last byte of the previous block, for rdungetb */
+};
+
+struct Rd {
+	Src;
 	int	nerrlab;
-	jmp_buf	errlab[50];	/* to do: depth */
+	jmp_buf	errlab[Nerrlab];	/* enough for Maxdepth */
 	char*	diag;
 	vlong	pos;
+	Seopt*	opt;	/* or nil */
+	vlong	maxatom;
+	int	depth;
+	int	maxdepth;
+	vlong	nodes;	/* left to make */
+	vlong	abytes;	/* bytes of atoms left */
+	int	cut;	/* end of input in memory was cut at maxinput (2: and reached) */
+	Biobuf*	bio;	/* input to check against maxinput, from in0 */
+	vlong	in0;
+	vlong	maxinput;
 };
 
-#define	rdgetb(rd)	((rd)->p!=nil? ((rd)->p == (rd)->end? -1: *(rd)->p++): Bgetc((rd)->t))
+#define	srcgetb(rd, s)	((s)->p!=nil? ((s)->p == (s)->end? srcfill(rd, s): *(s)->p++): Bgetc((s)->t))
+#define	rdgetb(rd)	srcgetb(rd, &(rd)->Src)
 
-static Sexp*	decodesform(Rd*, int (*)(uchar*, int, char*, int), int, String*);
+static Sexp*	decodesform(Rd*, int, String*);
 static Sexp*	parseitem(Rd*);
 static Sexp*	simplestring(Rd*, int, String*);
 static Sexp* sform(Rd*, uchar*, uint, String*);
-static String*	_b_new(void*, uint);
-static String*	quote(String*);
-static String*	toclosing(Rd*, int);
+static void	quote(String*, char*, uint);
 static String*	unquote(Rd*);
 static int	ws(Rd*);
-static int istextual(uchar*, uint);
-static int istoken(String*);
+static int istextual(Rd*, uchar*, uint);
+static int	utfrune(uchar*, uchar*);
+static int	numval(char*, uint, vlong*);
+static void	numtext(Sexp*);
+static int istoken(char*, uint);
 static int istokenc(int c);
-static uchar*	basedec(Rd*, int (*)(uchar*, int, char*, int), String*, uint*);
+static int	srcfill(Rd*, Src*);
+static Sexp*	transport(Rd*);
 static void*	ck(Rd*, void*);
+static void	synerr(Rd*, char*, vlong);
+
+/*
+ * limits: 0 in opt means the default, which for most is none.
+ * input in memory is cut short just past maxinput, and reaching the cut explains any error;
+ * input from a Biobuf is checked by ws.  rdlimit checks what a parse used in the end.
+ */
+static void
+rdopt(Rd *rd, Seopt *opt)
+{
+	rd->opt = opt;
+	rd->maxatom = Maxtoken;
+	rd->maxdepth = Maxdepth;
+	rd->depth = 0;
+	rd->nodes = 1LL<<62;
+	rd->abytes = 1LL<<62;
+	rd->cut = 0;
+	rd->bio = nil;
+	rd->maxinput = 0;
+	if(opt == nil)
+		return;
+	if(opt->maxatom > 0)
+		rd->maxatom = opt->maxatom < Maxatom? opt->maxatom: Maxatom;
+	if(opt->maxdepth > 0 && opt->maxdepth < Maxdepth)
+		rd->maxdepth = opt->maxdepth;
+	if(opt->maxnodes > 0)
+		rd->nodes = opt->maxnodes;
+	if(opt->maxbytes > 0)
+		rd->abytes = opt->maxbytes;
+	if(opt->maxinput > 0){
+		rd->maxinput = opt->maxinput;
+		if(rd->p == nil){
+			rd->bio = rd->t;
+			rd->in0 = Boffset(rd->t);
+		}else if(rd->end - rd->p > opt->maxinput+1){
+			rd->end = rd->p + opt->maxinput+1;	/* a byte to end a token */
+			rd->cut = 1;
+		}
+	}
+}
+
+static void
+rdlimit(Rd *rd)
+{
+	vlong n;
+
+	if(rd->maxinput == 0)
+		return;
+	n = rd->bio != nil? Boffset(rd->bio) - rd->in0: rd->p - rd->base;
+	if(n > rd->maxinput)
+		synerr(rd, "input longer than limit", Here);
+}
+
+/* charge n bytes of atoms against the limit; 0 if they exceed it */
+static int
+afford(Rd *rd, vlong n)
+{
+	return (rd->abytes -= n) >= 0;
+}
 
 static void
 rdaopen(Rd* rd, uchar* buf, uint buflen)
@@ -58,16 +153,21 @@ rdaopen(Rd* rd, uchar* buf, uint buflen)
 	rd->base = buf;
 	rd->p = rd->base;
 	rd->end = buf+buflen;
+	rd->tl = nil;
 	rd->diag = nil;
 	rd->pos = 0;
 	rd->nerrlab = 0;
+	rdopt(rd, nil);
 }
 
 static vlong
 rdoffset(Rd* rd)
 {
-	if(rd->p != nil)
+	if(rd->p != nil){
+		if(rd->tl != nil)
+			return rd->tl->off + (rd->p - rd->base);
 		return rd->p - rd->base;
+	}
 	return Boffset(rd->t);
 }
 
@@ -87,6 +187,10 @@ synerr(Rd* rd, char* diag, vlong pos)
 	if(rd->diag == nil){	/* record first one */
 		rd->diag = diag;
 		rd->pos = pos;
+		if(rd->cut == 2){	/* the real cause */
+			rd->diag = "input longer than limit";
+			rd->pos = Here;
+		}
 	}
 	nexterror();
 }
@@ -96,7 +200,9 @@ se_new(Rd *rd, int tag)
 {
 	Sexp *s;
 
-	s = ck(rd, mallocz(sizeof(*s), 1));
+	if(rd != nil && --rd->nodes < 0)
+		synerr(rd, "too many nodes", Here);
+	s = ck(rd, _se_alloc());
 	s->inuse = 1;
 	s->tag = tag;
 	return s;
@@ -112,9 +218,69 @@ se_string(String *s)
 	return e;
 }
 
+/* note whether a textual atom is a number, and if so its value */
+static void
+classify(Sexp *e, char *a, uint n)
+{
+	switch(numval(a, n, &e->num)){
+	case 1:
+		e->aflag |= Anum;
+		break;
+	case 0:
+		e->aflag |= Anotnum;
+		break;
+	}
+}
+
+/* atom whose value is small enough to keep in the node */
+static Sexp*
+smallatom(Rd *rd, int tag, void *a, uint n, String *hint)
+{
+	Sexp *e;
+
+	e = se_new(rd, tag);
+	memmove(e->inl, a, n);
+	e->inl[n] = 0;
+	e->ninl = n;
+	e->hint = hint;
+	if(tag == Sstring)
+		classify(e, a, n);
+	return e;
+}
+
+/* atom holding a copy of the n bytes at a */
+Sexp*
+_se_mkatom(int tag, void *a, uint n, String *hint)
+{
+	Sexp *e;
+	String *s;
+
+	if(n < Ninline)
+		return smallatom(nil, tag, a, n, hint);
+	if(tag == Sstring){
+		s = s_newalloc(n+1);
+		s_memappend(s, a, n);
+		s_terminate(s);
+	}else
+		s = b_new(a, n);
+	if(s == nil)
+		return nil;
+	e = se_new(nil, tag);
+	e->s = s;
+	e->hint = hint;
+	if(tag == Sstring)
+		classify(e, s_to_c(s), n);
+	return e;
+}
+
 Sexp*
 se_str(char *s)
 {
+	uint n;
+
+	n = strlen(s);
+	if(n < Ninline)
+		return smallatom(nil, Sstring, s, n, nil);
 	return se_string(s_copy(s));
 }
 
@@ -131,9 +297,31 @@ se_binary(String *b)
 Sexp*
 se_data(uchar *a, uint alen)
 {
+	if(alen < Ninline)
+		return smallatom(nil, Sbinary, a, alen, nil);
 	return se_binary(b_new(a, alen));
 }
 
+/*
+ * numeric atoms, formatted only when their text is needed
+ */
+Sexp*
+se_vlong(vlong v)
+{
+	Sexp *e;
+
+	e = se_new(nil, Sstring);
+	e->num = v;
+	e->aflag = Anum|Anotext;
+	return e;
+}
+
+Sexp*
+se_int(int v)
+{
+	return se_vlong(v);
+}
+
 Sexp*
 se_cons(Sexp *a, Sexp *b)
 {
@@ -167,7 +355,7 @@ se_form(char *a, Sexp *e0, ...)
 	Sexp *e, *l;
 	va_list ap;
 
-	e  = se_cons(se_string(s_copy(a)), nil);
+	e  = se_cons(se_str(a), nil);
 	if(e0 == nil)
 		return e;
 	e->tl = se_cons(e0, nil);
@@ -178,28 +366,35 @@ se_form(char *a, Sexp *e0, ...)
 	return e;
 }
 
+/*
+ * reference counts are changed atomically, without the node's Lock;
+ * static nodes (see sexp2c(1)) have none, and those of a compact tree share its root's
+ */
 Sexp*
 se_incref(Sexp *s)
 {
-	if(s != nil){
-		lock(s);
-		s->inuse++;
-		unlock(s);
-	}
+	if(s == nil || s->inuse == Sstatic)
+		return s;
+	if(s->inuse < 0)
+		ainc(&compactroot(s)->inuse);
+	else
+		ainc(&s->inuse);
 	return s;
 }
 
 void
 se_free(Sexp *e)
 {
-	if(e == nil)
+	if(e == nil || e->inuse == Sstatic)
 		return;
-	lock(e);
-	if(--e->inuse != 0){
-		unlock(e);
+	if(e->inuse < 0)
+		e = compactroot(e);
+	if(adec(&e->inuse) != 0)
+		return;
+	if(e->tag == Slist? e->lflag & Lcompact: e->aflag & Acompact){
+		_se_freecompact(e);
 		return;
 	}
-	unlock(e);
 	switch(e->tag){
 	case Sstring:
 	case Sbinary:
@@ -207,17 +402,26 @@ se_free(Sexp *e)
 			s_free(e->s);
 		if(e->hint != nil)
 			s_free(e->hint);
+		if(e->aflag & Abig)
+			free(e->big);
 		break;
 	case Slist:
 		se_free(e->hd);
 		se_free(e->tl);
+		free(e->pk);
 		break;
 	}
-	free(e);
+	_se_release(e);
 }
 
 Sexp*
 se_read(Biobuf *b, char *err, uint errlen)
+{
+	return se_readopt(b, err, errlen, nil);
+}
+
+Sexp*
+se_readopt(Biobuf *b, char *err, uint errlen, Seopt *opt)
 {
 	Rd rdb, *rd = &rdb;
 	Sexp *e;
@@ -225,8 +429,11 @@ se_read(Biobuf *b, char *err, uint errlen)
 	rd->t = b;
 	rd->base = nil;
 	rd->p = nil;
+	rd->tl = nil;
 	rd->diag = nil;
 	rd->pos = 0;
+	rd->nerrlab = 0;
+	rdopt(rd, opt);
 	if(waserror()){
 		if(rd->pos < 0)
 			rd->pos += Boffset(b);
@@ -238,6 +445,12 @@ se_read(Biobuf *b, char *err, uint errlen)
 	if(err != nil)
 		*err = 0;
 	e = parseitem(rd);
+	if(waserror()){
+		se_free(e);
+		nexterror();
+	}
+	rdlimit(rd);
+	poperror();
 	poperror();
 	return e;
 }
@@ -250,35 +463,172 @@ se_parse(char *s, char **ep)
 
 Sexp*
 se_unpack(char* buf, uint buflen, char **ep)
+{
+	return se_unpackopt(buf, buflen, ep, nil);
+}
+
+/*
+ * with options; big atoms left in buf by Bigref refer to it,
+ * so it must outlive the result
+ */
+Sexp*
+se_unpackopt(char* buf, uint buflen, char **ep, Seopt *opt)
 {
 	Rd rdb, *rd = &rdb;
 	Sexp *e;
 
 	rdaopen(rd, (uchar*)buf, buflen);
+	rdopt(rd, opt);
 	if(waserror()){
 		if(rd->pos < 0)
 			rd->pos += rdoffset(rd);
 		werrstr("%s at offset %lld", rd->diag, rd->pos);
-		*ep = buf;		/* perhaps */
+		if(ep != nil)
+			*ep = buf;		/* perhaps */
 		return nil;
 	}
 	e = parseitem(rd);
+	if(waserror()){
+		se_free(e);
+		nexterror();
+	}
+	rdlimit(rd);
+	poperror();
 	poperror();
 	if(ep != nil)
 		*ep = (char*)rd->p;
 	return e;
 }
 
+/*
+ * match a pattern against the next expression in the input, building
+ * only its atoms and the parts bound by %e, not the tree itself
+ */
+static void
+skipitem(Rd *rd, int c)
+{
+	int depth;
+
+	depth = 0;
+	for(;; c = ws(rd)){
+		if(c < 0)
+			synerr(rd, "unclosed '('", Here);
+		if(c == '(')
+			depth++;
+		else if(c == ')'){
+			if(--depth == 0)
+				return;
+		}else{
+			rdungetb(rd);
+			se_free(parseitem(rd));
+			if(depth == 0)
+				return;
+		}
+	}
+}
+
+static void
+skiprest(Rd *rd)
+{
+	int c;
+
+	while((c = ws(rd)) != ')'){
+		if(c < 0)
+			synerr(rd, "unclosed '('", Here);
+		skipitem(rd, c);
+	}
+}
+
+static int
+lexmatch(Rd *rd, Bind *b, int *pc)
+{
+	Pop *o;
+	Sexp *x;
+	int c, r;
+
+	c = ws(rd);
+	if(c < 0)
+		synerr(rd, "missing expression", Here);
+	if(c == ')')
+		synerr(rd, "unexpected ')'", Here);
+	o = &b->pat->op[*pc];
+	if(c == '(' && o->op == Popen){
+		(*pc)++;
+		for(;;){
+			c = ws(rd);
+			if(c < 0)
+				synerr(rd, "unclosed '('", Here);
+			o = &b->pat->op[*pc];
+			if(o->op == Prest){
+				if(c != ')'){
+					rdungetb(rd);
+					skiprest(rd);
+				}
+				*pc += 2;
+				return 1;
+			}
+			if(c == ')'){
+				if(o->op != Pclose)
+					return 0;
+				(*pc)++;
+				return 1;
+			}
+			rdungetb(rd);
+			if(o->op == Pclose || !lexmatch(rd, b, pc)){
+				skiprest(rd);
+				return 0;
+			}
+		}
+	}
+	if(c == '(' && o->op != Pany){
+		skipitem(rd, c);
+		return 0;
+	}
+	rdungetb(rd);
+	x = parseitem(rd);
+	r = _se_matchx(b, pc, x);
+	se_free(x);
+	return r;
+}
+
+int
+se_matchunpack(Sepat *p, char *buf, uint buflen, char **ep, ...)
+{
+	Rd rdb, *rd = &rdb;
+	Bind b;
+	va_list ap;
+	int pc, r;
+
+	va_start(ap, ep);
+	_se_bindinit(&b, p, ap, 1);
+	va_end(ap);
+	rdaopen(rd, (uchar*)buf, buflen);
+	if(waserror()){
+		_se_unbind(&b);
+		if(rd->pos < 0)
+			rd->pos += rdoffset(rd);
+		werrstr("%s at offset %lld", rd->diag, rd->pos);
+		if(ep != nil)
+			*ep = buf;
+		return -1;
+	}
+	pc = 0;
+	r = lexmatch(rd, &b, &pc);
+	poperror();
+	if(!r)
+		_se_unbind(&b);
+	if(ep != nil)
+		*ep = (char*)rd->p;
+	return r;
+}
+
 static Sexp*
 parseitem(Rd *rd)
 {
 	vlong p0;
 	int c;
-	Rd nrb, *nrd = &nrb;
 	Sexp *e, *le, *l;
 	String *a;
-	uchar *b;
-	uint blen;
 
 	p0 = rdoffset(rd);
 	c = ws(rd);
@@ -286,24 +636,10 @@ parseitem(Rd *rd)
 		return nil;
 	switch(c){
 	case '{':
-		a = toclosing(rd, '}');
-		if(waserror()){
-			s_free(a);
-			nexterror();
-		}
-		b = basedec(rd, dec64, a, &blen);
-		poperror();
-		s_free(a);
-		if(waserror()){
-			free(b);
-			nexterror();
-		}
-		rdaopen(nrd, b, blen);
-		e = parseitem(nrd);
-		poperror();
-		free(b);
-		return e;
+		return transport(rd);
 	case '(':
+		if(++rd->depth > rd->maxdepth)
+			synerr(rd, "nested too deeply", p0);
 		e = se_new(rd, Slist);
 		if(waserror()){
 			se_free(e);
@@ -325,6 +661,7 @@ parseitem(Rd *rd)
 			poperror();
 		}
 		poperror();
+		rd->depth--;
 		return e;
 	case '[':
 		/* display hint */
@@ -341,7 +678,7 @@ parseitem(Rd *rd)
 		}
 		if(e->tag != Sstring)
 			synerr(rd, "illegal display hint", Here);
-		a = e->s;
+		a = ck(rd, se_asdata(e));
 		e->s = nil;
 		poperror();
 		se_free(e);
@@ -372,104 +709,465 @@ ws(Rd* rd)
 
 	while(isspace(c = rdgetb(rd)))
 		{}
+	if(rd->bio != nil && Boffset(rd->bio) - rd->in0 > rd->maxinput)
+		synerr(rd, "input longer than limit", Here);
 	return c;
 }
 
+/*
+ * add c to the token accumulated in tok,
+ * moving it to a String when it outgrows tok
+ */
+static String*
+tokc(String *s, char *tok, int *np, int c)
+{
+	if(s == nil){
+		if(*np < Ninline-1){
+			tok[(*np)++] = c;
+			return nil;
+		}
+		s = s_newalloc(2*Ninline);
+		s_memappend(s, tok, *np);
+	}
+	s_putc(s, c);
+	return s;
+}
+
+/*
+ * up to n of the next bytes of input, at *pp:
+ * in the input itself if it is in memory, otherwise copied to buf.
+ * returns the number of bytes, 0 at the end
+ */
+static long
+rdblock(Rd *rd, uchar *buf, long n, uchar **pp)
+{
+	long m;
+
+	if(rd->p == nil){
+		*pp = buf;
+		m = Bread(rd->t, buf, n);
+		return m < 0? 0: m;
+	}
+	if(rd->p == rd->end){
+		if(srcfill(rd, &rd->Src) < 0)
+			return 0;
+		rd->p--;
+	}
+	m = rd->end - rd->p;
+	if(m > n)
+		m = n;
+	*pp = rd->p;
+	rd->p += m;
+	return m;
+}
+
+static void
+rdbytes(Rd *rd, uchar *a, vlong n)
+{
+	uchar *p;
+	long m;
+
+	for(; n > 0; n -= m, a += m){
+		m = rdblock(rd, a, n < Nbig? n: Nbig, &p);
+		if(m == 0)
+			synerr(rd, "missing bytes in raw token", Here);
+		if(p != a)
+			memmove(a, p, m);
+	}
+}
+
+/* whether a verbatim atom of n bytes is to be left out of memory */
+static int
+isbig(Rd *rd, vlong n)
+{
+	Seopt *o;
+
+	o = rd->opt;
+	return o != nil && o->big != Bigload && o->bigatom > 0 && n >= o->bigatom;
+}
+
+/*
+ * verbatim atom of n bytes, too big to keep in memory:
+ * give it to the sink, which returns what replaces it in the tree,
+ * or leave it in the spill file or input and describe where it lies
+ */
+static Sexp*
+bigatom(Rd *rd, vlong n, String *hint)
+{
+	Seopt *o;
+	Sebig *b;
+	Sexp *e;
+	Dir *d;
+	uchar buf[Nbig], *p;
+	vlong off, done;
+	long m;
+
+	o = rd->opt;
+	if(o->big == Bigsink){
+		if(o->sink == nil)
+			synerr(rd, "no sink for big atom", Here);
+		for(done = 0; done < n; done += m){
+			m = rdblock(rd, buf, n-done < Nbig? n-done: Nbig, &p);
+			if(m == 0)
+				synerr(rd, "missing bytes in raw token", Here);
+			o->sink(o->sinkarg, p, m);
+		}
+		e = o->sink(o->sinkarg, nil, 0);
+		if(e == nil)
+			synerr(rd, "big atom refused by sink", Here);
+		s_free(hint);
+		return e;
+	}
+	b = ck(rd, mallocz(sizeof(*b), 1));
+	if(waserror()){
+		free(b);
+		nexterror();
+	}
+	b->fd = -1;
+	b->len = n;
+	switch(o->big){
+	case Bigspill:
+		off = seek(o->spill, 0, 2);
+		if(off < 0)
+			synerr(rd, "can't seek spill file", Here);
+		for(done = 0; done < n; done += m){
+			m = rdblock(rd, buf, n-done < Nbig? n-done: Nbig, &p);
+			if(m == 0)
+				synerr(rd, "missing bytes in raw token", Here);
+			if(pwrite(o->spill, p, m, off+done) != m)
+				synerr(rd, "error writing spill file", Here);
+		}
+		b->fd = o->spill;
+		b->off = off;
+		break;
+	case Bigref:
+		if(rd->tl != nil)
+			synerr(rd, "big atom in transport encoding", Here);
+		if(rd->p != nil){
+			if(rd->end - rd->p < n)
+				synerr(rd, "missing bytes in raw token", Here);
+			b->base = rd->p;
+			rd->p += n;
+			break;
+		}
+		b->fd = Bfildes(rd->t);
+		b->off = Boffset(rd->t);
+		d = dirfstat(b->fd);
+		if(d == nil || d->length < b->off+n){
+			free(d);
+			synerr(rd, "missing bytes in raw token", Here);
+		}
+		free(d);
+		if(Bseek(rd->t, n, 1) != b->off+n)
+			synerr(rd, "can't seek past big atom", Here);
+		break;
+	default:
+		synerr(rd, "unknown treatment of big atom", Here);
+	}
+	e = se_new(rd, Sbinary);
+	poperror();
+	e->big = b;
+	e->aflag = Abig|Anotnum;
+	e->hint = hint;
+	return e;
+}
+
 static Sexp*
 simplestring(Rd* rd, int c, String* hint)
 {
-	int i, dec;
-	String *decs, *text, *s;
+	int i, n;
+	vlong dec;
+	String *text, *s;
 	uchar *a;
+	char tok[Ninline];
 	Sexp *e;
 
 	dec = -1;
-	decs = nil;
+	n = 0;
+	s = nil;
 	if(c >= '0' && c <= '9'){
-		decs = s_new();
 		for(dec = 0; c >= '0' && c <= '9'; c = rdgetb(rd)){
-			dec = dec*10 + c-'0';
-			s_putc(decs, c);
+			if(dec <= Maxatom)
+				dec = dec*10 + c-'0';	/* only a length if followed by a delimiter below */
+			s = tokc(s, tok, &n, c);
 		}
-		if(dec < 0 || dec > Maxtoken){
-			s_free(decs);
+		/* a big atom isn't held in memory, so it can be longer than maxatom */
+		if(dec > rd->maxatom && (c == ':' && !(dec <= Maxatom && isbig(rd, dec)) || c == '"' || c == '|' || c == '#')){
+			s_free(s);
 			synerr(rd, "implausible token length", Here);
 		}
-		s_terminate(decs);
 	}
 	switch(c){
 	case '"':
+		s_free(s);
 		text = unquote(rd);
+		if(!afford(rd, s_len(text))){
+			s_free(text);
+			synerr(rd, "atoms longer than limit", Here);
+		}
 		e = se_new(rd, Sstring);
 		e->s = text;
 		e->hint = hint;
 		return e;
 	case '|':
-		return decodesform(rd, dec64, c, hint);
+		s_free(s);
+		return decodesform(rd, c, hint);
 	case '#':
-		return decodesform(rd, dec16, c, hint);
+		s_free(s);
+		return decodesform(rd, c, hint);
 	default:
 		if(c == ':' && dec >= 0){	/* byte count of raw bytes */
+			s_free(s);
+			if(!afford(rd, dec))
+				synerr(rd, "atoms longer than limit", Here);
+			if(dec < Ninline){
+				for(i = 0; i < dec; i++){
+					c = rdgetb(rd);
+					if(c < 0)
+						synerr(rd, "missing bytes in raw token", Here);
+					tok[i] = c;
+				}
+				return smallatom(rd, istextual(rd, (uchar*)tok, dec)? Sstring: Sbinary, tok, dec, hint);
+			}
+			if(isbig(rd, dec))
+				return bigatom(rd, dec, hint);
+			if(dec != (uint)dec || (ulong)(dec+1) != dec+1)
+				synerr(rd, "implausible token length", Here);
 			a = ck(rd, malloc(dec+1));
-			for(i = 0; i < dec; i++){
-				c = rdgetb(rd);
-				if(c < 0)
-					synerr(rd, "missing bytes in raw token", Here);
-				a[i] = c;
+			if(waserror()){
+				free(a);
+				nexterror();
 			}
-			a[i] = 0;
+			rdbytes(rd, a, dec);
+			poperror();
+			a[dec] = 0;
 			return sform(rd, a, dec, hint);
 		}
-		if(RIVEST){
-			if(decs != nil){
-				s_free(decs);
-				synerr(rd, "token can't start with a digit", Here);
-			}
-		}else
-			s = decs;	/* not valid according to Rivest's s-expressions, but more convenient for users */
+		if(RIVEST && dec >= 0){
+			s_free(s);
+			synerr(rd, "token can't start with a digit", Here);
+		}
+		/* otherwise the digits start the token: not valid according to Rivest's s-expressions, but more convenient for users */
 		/* <token> by definition is always printable; never utf-8 */
 		while(istokenc(c)){
-			if(s == nil)
-				s = s_new();
-			s_putc(s, c);
+			s = tokc(s, tok, &n, c);
 			c = rdgetb(rd);
+			if((s != nil? s_len(s): n) > rd->maxatom){
+				s_free(s);
+				synerr(rd, "atom longer than limit", Here);
+			}
 		}
-		if(s == nil)
+		if(s == nil && n == 0)
 			synerr(rd, "missing token", Here);	/* consume c to ensure progress on error */
-		s_terminate(s);
+		if(!afford(rd, s != nil? s_len(s): n)){
+			s_free(s);
+			synerr(rd, "atoms longer than limit", Here);
+		}
 		if(c >= 0)
 			rdungetb(rd);
+		if(s == nil)
+			return smallatom(rd, Sstring, tok, n, hint);
+		s_terminate(s);
 		e = se_new(rd, Sstring);
 		e->s = s;
 		e->hint = hint;
+		classify(e, s_to_c(s), s_len(s));
 		return e;
 	}
 }
 
-static Sexp*
-decodesform(Rd *rd, int (*decode)(uchar*, int, char*, int), int c, String *hint)
+static int
+dec64c(int c)
 {
-	String *s;
-	uchar *a;
-	uint alen;
+	if(c >= 'A' && c <= 'Z')
+		return c-'A';
+	if(c >= 'a' && c <= 'z')
+		return 26+(c-'a');
+	if(c >= '0' && c <= '9')
+		return 52+(c-'0');
+	if(c == '+')
+		return 62;
+	if(c == '/')
+		return 63;
+	return -1;	/* including padding and white space */
+}
 
-	s = toclosing(rd, c);
-	if(waserror()){
-		s_free(s);
+static int	hex(int);
+
+/*
+ * |base64| or #hex#, decoded as it is read.
+ * like dec64 and dec16, ignore characters outside the encoding's alphabet
+ */
+static Sexp*
+decodesform(Rd *rd, int end, String *hint)
+{
+	uchar *a, *na;
+	uint alen, asize, v;
+	vlong p0;
+	int c, d, k;
+
+	asize = 64;
+	a = ck(rd, malloc(asize));
+	if(waserror()){
+		free(a);
 		nexterror();
 	}
-	a = basedec(rd, decode, s, &alen);
+	p0 = rdoffset(rd);
+	alen = 0;
+	v = 0;
+	k = 0;
+	while((c = rdgetb(rd)) != end){
+		if(c < 0)
+			synerr(rd, "missing closing delimiter", p0);
+		if(end == '|'){
+			if((d = dec64c(c)) < 0)
+				continue;
+			v = (v<<6) | d;
+			if(++k < 4)
+				continue;
+		}else{
+			if((d = hex(c)) < 0)
+				continue;
+			v = (v<<4) | d;
+			if(++k < 2)
+				continue;
+		}
+		if(alen+3 >= asize){
+			if(alen > rd->maxatom || asize > ~0U/2)	/* or than a uint can count */
+				synerr(rd, "atom longer than limit", Here);
+			asize *= 2;
+			na = ck(rd, realloc(a, asize));
+			a = na;
+		}
+		if(end == '|'){
+			a[alen++] = v>>16;
+			a[alen++] = v>>8;
+		}
+		a[alen++] = v;
+		v = 0;
+		k = 0;
+	}
+	if(end == '|' && k > 1){	/* partial quantum without padding */
+		if(alen+3 >= asize){
+			na = ck(rd, realloc(a, asize+3));
+			a = na;
+		}
+		v <<= 6*(4-k);
+		a[alen++] = v>>16;
+		if(k == 3)
+			a[alen++] = v>>8;
+	}
+	a[alen] = 0;
+	if(alen > rd->maxatom)
+		synerr(rd, "atom longer than limit", Here);
+	if(!afford(rd, alen))
+		synerr(rd, "atoms longer than limit", Here);
 	poperror();
-	s_free(s);
 	return sform(rd, a, alen, hint);
 }
 
+/*
+ * refill s from its transport encoding, returning the next byte or -1 at the end
+ */
+static int
+srcfill(Rd *rd, Src *s)
+{
+	Tl *tl;
+	uchar *o, *e;
+	uint v;
+	int c, d, k;
+
+	tl = s->tl;
+	if(tl == nil && rd->cut)
+		rd->cut = 2;	/* the parse might still end here */
+	if(tl == nil || tl->eof)
+		return -1;
+	tl->off += s->end - s->base - 1;
+	tl->buf[0] = s->end[-1];
+	o = tl->buf+1;
+	e = o+Nblk;
+	v = 0;
+	k = 0;
+	while(o < e){
+		c = srcgetb(rd, &tl->src);
+		if(c < 0)
+			synerr(rd, "missing closing delimiter", Here);
+		if(c == '}'){
+			tl->eof = 1;
+			if(k > 1){
+				v <<= 6*(4-k);
+				*o++ = v>>16;
+				if(k == 3)
+					*o++ = v>>8;
+			}
+			break;
+		}
+		if((d = dec64c(c)) < 0)
+			continue;
+		v = (v<<6) | d;
+		if(++k == 4){
+			*o++ = v>>16;
+			*o++ = v>>8;
+			*o++ = v;
+			v = 0;
+			k = 0;
+		}
+	}
+	s->base = tl->buf;
+	s->p = tl->buf+1;
+	s->end = o;
+	if(s->p == s->end)
+		return -1;
+	return *s->p++;
+}
+
+/*
+ * {base64}: parse the expression encoded within, decoding it as it is read
+ */
+static Sexp*
+transport(Rd *rd)
+{
+	Tl tl;
+	Sexp *e;
+
+	if(++rd->depth > rd->maxdepth)
+		synerr(rd, "nested too deeply", Here);
+	tl.src = rd->Src;
+	tl.eof = 0;
+	tl.off = -1;
+	rd->t = nil;
+	rd->base = tl.buf;
+	rd->p = rd->end = tl.buf+1;
+	rd->tl = &tl;
+	if(waserror()){
+		rd->Src = tl.src;
+		nexterror();
+	}
+	e = parseitem(rd);
+	if(waserror()){
+		se_free(e);
+		nexterror();
+	}
+	while(rdgetb(rd) >= 0)
+		{}	/* anything after the expression is ignored */
+	poperror();
+	poperror();
+	rd->Src = tl.src;
+	rd->depth--;
+	return e;
+}
+
 static Sexp*
 sform(Rd *rd, uchar* a, uint alen, String* hint)
 {
 	Sexp *e;
 
-	if(istextual(a, alen)){
+	if(alen < Ninline){
+		e = smallatom(rd, istextual(rd, a, alen)? Sstring: Sbinary, a, alen, hint);
+		free(a);
+		return e;
+	}
+	if(istextual(rd, a, alen)){
 		e = se_new(rd, Sstring);
 		e->s = s_copy((char*)a);
 		e->hint = hint;
@@ -480,29 +1178,10 @@ sform(Rd *rd, uchar* a, uint alen, String* hint)
 	e->s = _b_new((char*)a, alen);
 	if(e->s == nil)
 		synerr(rd, "out of memory", Here);
+	e->hint = hint;
 	return e;
 }
 
-static String*
-toclosing(Rd* rd, int end)
-{
-	String *s;
-	vlong p0;
-	int c;
-
-	s = s_new();
-	p0 = rdoffset(rd);
-	while((c = rdgetb(rd)) != end){
-		if(c < 0){
-			s_free(s);
-			synerr(rd, "missing closing delimiter", p0);
-		}
-		s_putc(s, c);
-	}
-	s_terminate(s);
-	return s;
-}
-
 static int
 hex(int c)
 {
@@ -590,6 +1269,10 @@ unquote(Rd* rd)
 			}
 		}
 		s_putc(os, c);
+		if(s_len(os) > rd->maxatom){
+			s_free(os);
+			synerr(rd, "atom longer than limit", Here);
+		}
 	}
 	s_terminate(os);
 	return os;
@@ -610,22 +1293,29 @@ hintlen(String* s)
 uint
 se_packedsize(Sexp *e)
 {
-	int n;
+	uint n;
 	char buf[30];
+	Sexp *l;
 
 	if(e == nil)
 		return 0;
 	switch(e->tag){
 	case Sstring:
 	case Sbinary:
-		n = s_len(e->s);
-		return hintlen(e->hint) + snprint(buf, sizeof(buf), "%d:", n) + n;
+		se_atom(e, &n);
+		return hintlen(e->hint) + snprint(buf, sizeof(buf), "%ud:", n) + n;
 	case Slist:
+		if(e->npk != 0)
+			return e->npk;
+		l = e;
 		n = 1;	/* '(' */
 		do{
 			n += se_packedsize(e->hd);
 		}while((e = e->tl) != nil);
-		return n+1;	/* + ')' */
+		n++;	/* ')' */
+		if(l->lflag & Lcache)
+			l->npk = n;
+		return n;
 	default:
 		return 0;
 	}
@@ -634,10 +1324,10 @@ se_packedsize(Sexp *e)
 static uchar*
 packbytes(uchar *a, uchar *b, uint n)
 {
-	char buf[10];
+	char buf[32];
 	int nl;
 
-	nl = snprint(buf, sizeof buf, "%d:", n);
+	nl = snprint(buf, sizeof buf, "%ud:", n);
 	memmove(a, buf, nl);
 	a += nl;
 	memmove(a, b, n);
@@ -655,9 +1345,37 @@ packhint(uchar *a, String *s)
 	return a;
 }
 
+/* keep a copy of the canonical form of list l, just packed at a */
+static void
+keep(Sexp *l, uchar *a, uint n)
+{
+	uchar *pk;
+
+	if(n < Mincache)
+		return;
+	pk = malloc(n);
+	if(pk == nil)
+		return;
+	memmove(pk, a, n);
+	lock(l);
+	if(l->pk == nil){
+		l->npk = n;
+		coherence();
+		l->pk = pk;
+		pk = nil;
+	}
+	unlock(l);
+	free(pk);
+}
+
 static uchar*
 pack(uchar* a, Sexp *e)
 {
+	char *p;
+	uint n;
+	uchar *a0;
+	Sexp *l;
+
 	if(e == nil)
 		return a;
 	switch(e->tag){
@@ -665,19 +1383,56 @@ pack(uchar* a, Sexp *e)
 	case Sbinary:
 		if(e->hint != nil)
 			a = packhint(a, e->hint);
-		return packbytes(a, (uchar*)s_to_c(e->s), s_len(e->s));
+		p = se_atom(e, &n);
+		return packbytes(a, (uchar*)p, n);
 	case Slist:
+		if(e->pk != nil){
+			memmove(a, e->pk, e->npk);
+			return a+e->npk;
+		}
+		l = e;
+		a0 = a;
 		*a++ = '(';
 		do{
 			a = pack(a, e->hd);
 		}while((e = e->tl) != nil);
 		*a++ = ')';
+		if(l->lflag & Lcache)
+			keep(l, a0, a-a0);
 		return a;
 	default:
 		return a;
 	}
 }
 
+/*
+ * keep the canonical forms of e and the lists within it, once packed,
+ * until they are changed by se_patch
+ */
+void
+se_packcache(Sexp *e)
+{
+	if(e == nil || e->tag != Slist || e->inuse < 0)
+		return;
+	e->lflag |= Lcache;
+	for(; e != nil; e = e->tl)
+		se_packcache(e->hd);
+}
+
+/*
+ * node e is about to change: forget what is cached about it
+ */
+void
+_se_dirty(Sexp *e)
+{
+	e->hash = 0;
+	if(e->tag == Slist){
+		free(e->pk);
+		e->pk = nil;
+		e->npk = 0;
+	}
+}
+
 uint
 se_pack(uchar* buf, uint buflen, Sexp *e)
 {
@@ -690,30 +1445,163 @@ se_pack(uchar* buf, uint buflen, Sexp *e)
 	return nb;
 }
 
+/*
+ * base64 encoding of the canonical form, produced on the fly
+ */
+typedef struct Enc Enc;
+struct Enc {
+	uchar	q[3];	/* bytes not yet encoded */
+	int	nq;
+	char	buf[4*Nblk/3];
+	int	n;
+	String*	s;	/* output to s, or */
+	Biobuf*	bp;	/* to bp */
+	long	nout;
+	int	err;
+};
+
+static char t64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void
+encflush(Enc *enc)
+{
+	if(enc->n == 0)
+		return;
+	if(enc->s != nil)
+		s_memappend(enc->s, enc->buf, enc->n);
+	else if(!enc->err && Bwrite(enc->bp, enc->buf, enc->n) != enc->n)
+		enc->err = 1;
+	enc->nout += enc->n;
+	enc->n = 0;
+}
+
+static void
+enc3(Enc *enc, uchar *a)
+{
+	char *o;
+
+	if(enc->n+4 > sizeof(enc->buf))
+		encflush(enc);
+	o = enc->buf+enc->n;
+	o[0] = t64[a[0]>>2];
+	o[1] = t64[((a[0]<<4) | (a[1]>>4)) & 0x3F];
+	o[2] = t64[((a[1]<<2) | (a[2]>>6)) & 0x3F];
+	o[3] = t64[a[2] & 0x3F];
+	enc->n += 4;
+}
+
+static void
+encput(Enc *enc, uchar *a, uint n)
+{
+	while(enc->nq != 0 && n > 0){
+		enc->q[enc->nq++] = *a++;
+		n--;
+		if(enc->nq == 3){
+			enc3(enc, enc->q);
+			enc->nq = 0;
+		}
+	}
+	for(; n >= 3; n -= 3, a += 3)
+		enc3(enc, a);
+	while(n-- > 0)
+		enc->q[enc->nq++] = *a++;
+}
+
+static void
+encend(Enc *enc)
+{
+	int nq;
+
+	nq = enc->nq;
+	if(nq != 0){
+		memset(enc->q+nq, 0, 3-nq);
+		enc3(enc, enc->q);
+		enc->buf[enc->n-1] = '=';
+		if(nq == 1)
+			enc->buf[enc->n-2] = '=';
+		enc->nq = 0;
+	}
+	encflush(enc);
+}
+
+static void
+encbytes(Enc *enc, uchar *b, uint n)
+{
+	char buf[16];
+
+	encput(enc, (uchar*)buf, snprint(buf, sizeof buf, "%ud:", n));
+	encput(enc, b, n);
+}
+
+static void
+packenc(Enc *enc, Sexp *e)
+{
+	char *p;
+	uint n;
+
+	if(e == nil)
+		return;
+	switch(e->tag){
+	case Sstring:
+	case Sbinary:
+		if(e->hint != nil && s_len(e->hint) != 0){
+			encput(enc, (uchar*)"[", 1);
+			encbytes(enc, (uchar*)s_to_c(e->hint), s_len(e->hint));
+			encput(enc, (uchar*)"]", 1);
+		}
+		p = se_atom(e, &n);
+		encbytes(enc, (uchar*)p, n);
+		break;
+	case Slist:
+		if(e->pk != nil){
+			encput(enc, e->pk, e->npk);
+			break;
+		}
+		encput(enc, (uchar*)"(", 1);
+		do{
+			packenc(enc, e->hd);
+		}while((e = e->tl) != nil);
+		encput(enc, (uchar*)")", 1);
+		break;
+	}
+}
+
 String*
 se_b64text(Sexp *e)
 {
-	String *s;
-	uchar *b;
-	char *a;
-	int n, np;
+	Enc enc;
+	uint np;
 
 	np = se_packedsize(e);
-	b = malloc(np);
-	if(b == nil)
+	memset(&enc, 0, sizeof(enc));
+	enc.s = s_newalloc(1+(np+2)/3*4+1+1);
+	if(enc.s == nil)
 		return nil;
-	if(se_pack(b, np, e) != np)
-		sysfatal("se_b64text: botch");
-	n = (np/3+1)*4 + 1;
-	a = malloc(n+2+1);
-	a[0] = '{';
-	n = enc64(a+1, n, b, np);
-	a[1+n] = '}';
-	a[1+n+1] = 0;
-	s = s_copy(a);
-	free(a);
-	free(b);
-	return s;
+	s_putc(enc.s, '{');
+	packenc(&enc, e);
+	encend(&enc);
+	s_putc(enc.s, '}');
+	s_terminate(enc.s);
+	return enc.s;
+}
+
+long
+se_writeb64(Biobuf *bp, Sexp *e)
+{
+	Enc enc;
+
+	memset(&enc, 0, sizeof(enc));
+	enc.bp = bp;
+	enc.buf[enc.n++] = '{';
+	packenc(&enc, e);
+	encend(&enc);
+	if(Bputc(bp, '}') < 0)
+		enc.err = 1;
+	if(enc.err){
+		werrstr("se_writeb64: write error: %r");
+		return -1;
+	}
+	return enc.nout+1;
 }
 
 static String*
@@ -728,42 +1616,48 @@ String*
 se_text(Sexp *e)
 {
 	String *s;
-	char *buf;
-	int n;
+	char *buf, *p;
+	uint n;
 
 	if(e == nil)
 		return s_copy("");
 	switch(e->tag){
 	case Sstring:
+		p = se_atom(e, &n);
+		s = s_newalloc(n+3);
 		if(e->hint != nil){
-			s = s_copy("[");
-			cat(s, quote(e->hint));
+			s_putc(s, '[');
+			quote(s, s_to_c(e->hint), s_len(e->hint));
 			s_putc(s, ']');
-			cat(s, quote(e->s));
-			return s;
 		}
-		//s_terminate(e->s);
-		return quote(e->s);
+		quote(s, p, n);
+		s_terminate(s);
+		return s;
 	case Sbinary:
-		/* TO DO: e->hint */
-		n = s_len(e->s);
+		p = se_atom(e, &n);
 		if(n <= 4){
 			buf = malloc(2+n*2+1);	/* delimiters, encoded data, null byte */
 			if(buf == nil)
 				return nil;
 			buf[0] = '#';
-			n = enc16(buf+1, n*2+1, (uchar*)e->s->base, n);
+			n = enc16(buf+1, n*2+1, (uchar*)p, n);
 			buf[1+n] = '#';
 		}else{
 			buf = malloc(2+(n/3+1)*4+1);
 			if(buf == nil)
 				return nil;
 			buf[0] = '|';
-			n = enc64(buf+1, n*4/3+1, (uchar*)e->s->base, n);
+			n = enc64(buf+1, (n/3+1)*4+1, (uchar*)p, n);
 			buf[1+n] = '|';
 		}
 		buf[n+2] = 0;
-		s = s_copy(buf);
+		s = s_newalloc(n+3);
+		if(e->hint != nil){
+			s_putc(s, '[');
+			quote(s, s_to_c(e->hint), s_len(e->hint));
+			s_putc(s, ']');
+		}
+		s_append(s, buf);
 		free(buf);
 		return s;
 	case Slist:
@@ -805,17 +1699,15 @@ istokenc(int c)
 }
 
 static int
-istoken(String* s)
+istoken(char *p, uint n)
 {
-	char *p;
-	int i;
+	uint i;
 
-	if(s == nil || s_len(s) == 0)
+	if(n == 0)
 		return 0;
-	p = s_to_c(s);
 	if(*p >= '0' && *p <= '9')
 		return 0;	/* Rivest's s-expressions don't allow tokens to start with digits */
-	for(i = 0; i < s_len(s); i++, p++){
+	for(i = 0; i < n; i++, p++){
 		if(!(*p >= 'a' && *p <= 'z' || *p >= 'A' && *p <= 'Z' || *p >= '0' && *p <= '9' ||
 		      *p == '-' || *p == '.' || *p == '/' || *p == '_' || *p == ':' || *p == '*' || *p == '+' || *p == '='))
 			return 0;
@@ -825,41 +1717,93 @@ istoken(String* s)
 
 /*
  * should the data qualify as binary or text?
- *  the if(0) version accepts valid Unicode sequences
- * could use [display] to control character set?
+ * text is printable ASCII and white space, and if rd's options allow,
+ * valid UTF-8 for runes other than controls.
+ * printable ASCII is passed over a word at a time.
  */
+#define	ONES	0x0101010101010101ULL
+
 static int
-istextual(uchar* a, uint alen)
-{
-	int i, c;
-
-	for(i = 0; i < alen;){
-//		if(0){
-//			(c, n, ok) := sys->byte2char(a, i);
-//			if(!ok || c < ' ' && !isspace(c) || c >= 0x7F)
-//				return 0;
-//			i += n;
-//		}else{
-			c = a[i++];
-			if(c < ' ' && !isspace(c) || c >= 0x7F)
-				return 0;
-//		}
+istextual(Rd *rd, uchar* a, uint alen)
+{
+	uchar *e;
+	uvlong w;
+	int c, n, utf;
+
+	utf = rd != nil && rd->opt != nil && rd->opt->utf8;
+	e = a+alen;
+	while(a < e){
+		if(((uintptr)a & 7) == 0 && e-a >= 8){
+			w = *(uvlong*)a;
+			/* no byte below ' ', none above '~' */
+			if((((w - ONES*' ' & ~w) | (w + ONES | w)) & ONES*0x80) == 0){
+				a += 8;
+				continue;
+			}
+		}
+		c = *a;
+		if(c >= ' ' && c < 0x7F || isspace(c))
+			a++;
+		else if(utf && c >= 0x80 && (n = utfrune(a, e)) > 0)
+			a += n;
+		else
+			return 0;
 	}
 	return 1;
 }
 
-static String*
-quote(String *s)
+/*
+ * length of the valid UTF-8 sequence at p, not past e, for a rune that isn't a control;
+ * 0 if there's none
+ */
+static int
+utfrune(uchar *p, uchar *e)
 {
-	int c;
-	String *os;
-	char* p, buf[8];
+	ulong r, min;
+	int n, i;
+
+	if(*p < 0xC2)
+		return 0;	/* continuation, or too long a form */
+	if(*p < 0xE0){
+		n = 2;
+		r = *p & 0x1F;
+		min = 0xA0;	/* not C1 controls */
+	}else if(*p < 0xF0){
+		n = 3;
+		r = *p & 0x0F;
+		min = 0x800;
+	}else if(*p < 0xF5){
+		n = 4;
+		r = *p & 0x07;
+		min = 0x10000;
+	}else
+		return 0;
+	if(e-p < n)
+		return 0;
+	for(i = 1; i < n; i++){
+		if((p[i] & 0xC0) != 0x80)
+			return 0;
+		r = r<<6 | p[i] & 0x3F;
+	}
+	if(r < min || r > 0x10FFFF || r >= 0xD800 && r <= 0xDFFF)
+		return 0;
+	return n;
+}
 
-	if(istoken(s))
-		return s_incref(s);
-	os = s_newalloc(s_len(s)+2);
+/* append the n bytes at p to os, quoted if need be; valid UTF-8 is copied as it is */
+static void
+quote(String *os, char *p, uint n)
+{
+	int c, k;
+	char buf[8], *e;
+
+	if(istoken(p, n)){
+		s_memappend(os, p, n);
+		return;
+	}
 	s_putc(os, '"');
-	for(p = s_to_c(s); (c = *p) != 0; p++){
+	for(e = p+n; p < e; p++){
+		c = *p;
 		switch(c){
 		case '"':	s_append(os, "\\\""); break;
 		case '\\':	s_append(os, "\\\\"); break;
@@ -870,16 +1814,18 @@ quote(String *s)
 		case '\r':	s_append(os, "\\r"); break;
 		case '\v':	s_append(os, "\\v"); break;
 		default:
-			if(c < ' ' || c >= 0x7F){
+			if(c & 0x80 && (k = utfrune((uchar*)p, (uchar*)e)) > 0){
+				s_memappend(os, p, k);
+				p += k-1;
+			}else if(c < ' ' || c >= 0x7F){
 				snprint(buf, sizeof(buf), "\\x%.2ux", c & 0xFF);
 				s_append(os, buf);
-			}else
+			}else{
 				s_putc(os, *p);
+			}
 		}
 	}
 	s_putc(os, '"');
-	s_terminate(os);
-	return os;
 }
 
 /*
@@ -940,7 +1886,7 @@ se_op(Sexp *e)
 	}
 	if(e->tag != Sstring)
 		return nil;
-	return s_to_c(e->s);
+	return se_atom(e, nil);
 }
 
 Sexp*
@@ -951,21 +1897,319 @@ se_args(Sexp *e)
 	return e->tl;
 }
 
+/*
+ * bring a big atom's value into memory, once.
+ * one left in the parser's input is referred to, not copied
+ */
+static int
+bigload(Sexp *e)
+{
+	Sebig *b;
+	String *s;
+	uchar *p;
+	vlong o;
+	long m;
+
+	lock(e);
+	if(e->s != nil){
+		unlock(e);
+		return 0;
+	}
+	b = e->big;
+	if(b->len != (uint)b->len || (ulong)(b->len+1) != b->len+1){
+		unlock(e);
+		werrstr("big atom too big for memory");
+		return -1;
+	}
+	if(b->base != nil){
+		s = _b_new(b->base, b->len);
+		if(s != nil)
+			s->fixed = 1;	/* not ours to free */
+	}else{
+		s = nil;
+		p = malloc(b->len+1);
+		if(p != nil){
+			for(o = 0; o < b->len; o += m){
+				m = b->len-o < Maxtoken? b->len-o: Maxtoken;
+				m = pread(b->fd, p+o, m, b->off+o);
+				if(m <= 0)
+					break;
+			}
+			p[o] = 0;
+			if(o == b->len)
+				s = _b_new(p, b->len);
+			if(s == nil)
+				free(p);
+		}
+	}
+	if(s == nil){
+		unlock(e);
+		werrstr("can't load big atom: %r");
+		return -1;
+	}
+	coherence();
+	e->s = s;
+	unlock(e);
+	return 0;
+}
+
+/*
+ * value of an atom, and its length; small values are in the node.
+ * unlike se_asdata, allocates only to format a large number made by se_vlong,
+ * or to load a big atom from the file where the parser left it
+ */
+char*
+se_atom(Sexp *e, uint *np)
+{
+	uint n;
+	char *p;
+
+	if(np != nil)
+		*np = 0;
+	if(e == nil || e->tag != Sbinary && e->tag != Sstring)
+		return nil;
+	if(e->aflag & Anotext)
+		numtext(e);
+	if(e->aflag & Abig && e->s == nil && bigload(e) < 0)
+		return nil;
+	if(e->s == nil){
+		p = e->inl;
+		n = e->ninl;
+	}else{
+		p = s_to_c(e->s);
+		n = s_len(e->s);
+	}
+	if(np != nil)
+		*np = n;
+	return p;
+}
+
+/*
+ * length of an atom's value, without loading a big one
+ */
+vlong
+se_atomlen(Sexp *e)
+{
+	uint n;
+
+	if(e == nil || e->tag != Sbinary && e->tag != Sstring)
+		return -1;
+	if(e->aflag & Abig)
+		return e->big->len;
+	se_atom(e, &n);
+	return n;
+}
+
+/*
+ * up to n bytes of an atom's value from offset off, without loading a big one.
+ * returns the number of bytes read, 0 at the end, or -1 on error
+ */
+long
+se_atomread(Sexp *e, void *buf, long n, vlong off)
+{
+	Sebig *b;
+	char *p;
+	uint len;
+
+	if(e == nil || e->tag != Sbinary && e->tag != Sstring || off < 0){
+		werrstr("se_atomread: bad argument");
+		return -1;
+	}
+	if(e->aflag & Abig && e->s == nil){
+		b = e->big;
+		if(off >= b->len)
+			return 0;
+		if(n > b->len-off)
+			n = b->len-off;
+		if(b->base != nil){
+			memmove(buf, b->base+off, n);
+			return n;
+		}
+		return pread(b->fd, buf, n, b->off+off);
+	}
+	p = se_atom(e, &len);
+	if(off >= len)
+		return 0;
+	if(n > len-off)
+		n = len-off;
+	memmove(buf, p+off, n);
+	return n;
+}
+
 String*
 se_asdata(Sexp *e)
 {
+	String *s;
+
 	if(e == nil || e->tag != Sbinary && e->tag != Sstring)
 		return nil;
+	if(e->aflag & Anotext)
+		numtext(e);
+	if(e->aflag & Abig && e->s == nil && bigload(e) < 0)
+		return nil;
+	if(e->s != nil)
+		return e->s;
+	/* first request for a small value as a String */
+	lock(e);
+	if(e->s == nil){
+		if(e->tag == Sstring){
+			s = s_newalloc(e->ninl+1);
+			s_memappend(s, e->inl, e->ninl);
+			s_terminate(s);
+		}else
+			s = b_new(e->inl, e->ninl);
+		e->s = s;
+	}
+	unlock(e);
 	return e->s;
 }
 
 String*
 se_astext(Sexp *e)
 {
-	if(e == nil || e->tag != Sstring && e->tag != Sbinary || e->tag == Sbinary && e->s->fixed)
+	String *s;
+
+	s = se_asdata(e);
+	if(s == nil)
 		return nil;
-	s_terminate(e->s);
-	return e->s;
+	if(s->ptr < s->end && *s->ptr == 0)
+		return s;	/* already terminated, perhaps read-only */
+	if(e->tag == Sbinary && s->fixed)
+		return nil;
+	s_terminate(s);
+	return s;
+}
+
+/*
+ * [+-]digits or [+-]0xhexdigits:
+ * returns 1 and sets *vp if the n bytes at p are a number,
+ * 0 if they are not, and -1 if the number won't fit
+ */
+static int
+numval(char *p, uint n, vlong *vp)
+{
+	char *ep;
+	uvlong v, lim;
+	int neg, base, d;
+
+	ep = p+n;
+	neg = 0;
+	if(p < ep && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	base = 10;
+	if(ep-p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')){
+		base = 16;
+		p += 2;
+	}
+	if(p == ep)
+		return 0;
+	lim = (1ULL<<63) - !neg;
+	for(v = 0; p < ep; p++){
+		d = hex(*p);
+		if(d < 0 || d >= base)
+			return 0;
+		if(v > (lim-d)/base){
+			while(++p < ep)
+				if(hex(*p) < 0 || hex(*p) >= base)
+					return 0;
+			return -1;
+		}
+		v = v*base + d;
+	}
+	*vp = neg? -v: v;
+	return 1;
+}
+
+/* make the text of a number made by se_vlong */
+static void
+numtext(Sexp *e)
+{
+	char buf[24], *p;
+	uvlong v;
+	String *s;
+	uint n;
+
+	lock(e);
+	if(e->aflag & Anotext){
+		p = buf+sizeof(buf);
+		v = e->num;
+		if(e->num < 0)
+			v = -v;
+		do
+			*--p = '0' + v%10;
+		while((v /= 10) != 0);
+		if(e->num < 0)
+			*--p = '-';
+		n = buf+sizeof(buf) - p;
+		if(n < Ninline){
+			memmove(e->inl, p, n);
+			e->inl[n] = 0;
+			e->ninl = n;
+		}else{
+			s = s_newalloc(n+1);
+			s_memappend(s, p, n);
+			s_terminate(s);
+			e->s = s;
+		}
+		coherence();
+		e->aflag &= ~Anotext;
+	}
+	unlock(e);
+}
+
+/*
+ * value of a numeric atom, determined once and kept in the node.
+ * returns -1 if e isn't a number or the value won't fit
+ */
+int
+se_asvlong(Sexp *e, vlong *vp)
+{
+	char *p;
+	uint n;
+	vlong v;
+	int r;
+
+	if(e == nil || e->tag == Slist){
+		werrstr("not an atom");
+		return -1;
+	}
+	if((e->aflag & (Anum|Anotnum)) == 0){
+		p = se_atom(e, &n);
+		r = numval(p, n, &v);
+		if(r < 0){
+			werrstr("number out of range");
+			return -1;
+		}
+		lock(e);
+		if(r > 0){
+			e->num = v;
+			coherence();
+			e->aflag |= Anum;
+		}else
+			e->aflag |= Anotnum;
+		unlock(e);
+	}
+	if(e->aflag & Anotnum){
+		werrstr("not a number");
+		return -1;
+	}
+	*vp = e->num;
+	return 0;
+}
+
+int
+se_asint(Sexp *e, int *vp)
+{
+	vlong v;
+
+	if(se_asvlong(e, &v) < 0)
+		return -1;
+	if(v > 0x7FFFFFFF || v < -0x7FFFFFFF-1){
+		werrstr("number out of range");
+		return -1;
+	}
+	*vp = v;
+	return 0;
 }
 
 static int
@@ -973,11 +2217,25 @@ seq(String* s1, String* s2)
 {
 	if(s1 == s2)
 		return 1;
-	if(s1 == nil)
+	if(s1 == nil || s2 == nil)
 		return 0;
 	return strcmp(s_to_c(s1), s_to_c(s2)) == 0;
 }
 
+/* atoms e1 and e2 have equal values and hints */
+static int
+atomeq(Sexp *e1, Sexp *e2)
+{
+	char *p1, *p2;
+	uint n1, n2;
+
+	if(!seq(e1->hint, e2->hint))
+		return 0;
+	p1 = se_atom(e1, &n1);
+	p2 = se_atom(e2, &n2);
+	return n1 == n2 && memcmp(p1, p2, n1) == 0;
+}
+
 int
 se_eq(Sexp *e1, Sexp *e2)
 {
@@ -994,11 +2252,8 @@ se_eq(Sexp *e1, Sexp *e2)
 		}while((e1 = e1->tl) != nil);
 		return e1 == e2;
 	case Sstring:
-		return seq(e1->s, e2->s) && seq(e1->hint, e2->hint);
 	case Sbinary:
-		if(s_len(e1->s) != s_len(e2->s) || !seq(e1->hint, e2->hint))
-			return 0;
-		return memcmp(e1->s->base, e2->s->base, s_len(e1->s)) == 0;
+		return atomeq(e1, e2);
 	}
 	return 0;
 }
@@ -1015,16 +2270,33 @@ se_copy(Sexp *e)
 		o = se_new(nil, Slist);
 		o->hd = se_copy(e->hd);
 		o->tl = se_copy(e->tl);
+		o->lflag = e->lflag & ~Lcompact;
 		return o;
 	case Sstring:
-		o = se_new(nil, e->tag);
-		o->s = s_clone(e->s);
-		if(e->hint != nil)
-			o->hint = s_clone(e->hint);
-		return o;
 	case Sbinary:
 		o = se_new(nil, e->tag);
-		o->s = b_copy(e->s);
+		if(e->aflag & Abig){	/* share the source, not the value */
+			o->big = malloc(sizeof(*o->big));
+			if(o->big == nil){
+				_se_release(o);
+				return nil;
+			}
+			*o->big = *e->big;
+			o->aflag = e->aflag & ~Acompact;
+			if(e->hint != nil)
+				o->hint = s_clone(e->hint);
+			return o;
+		}
+		se_atom(e, nil);	/* format a number */
+		o->num = e->num;
+		o->aflag = e->aflag & ~Acompact;
+		if(e->s == nil){
+			memmove(o->inl, e->inl, sizeof(o->inl));
+			o->ninl = e->ninl;
+		}else if(e->tag == Sstring)
+			o->s = s_clone(e->s);
+		else
+			o->s = b_copy(e->s);
 		if(e->hint != nil)
 			o->hint = s_clone(e->hint);
 		return o;
@@ -1032,11 +2304,43 @@ se_copy(Sexp *e)
 	return nil;
 }
 
+/* whether no node or atom value of e is shared, so that it can be changed in place */
+static int
+unshared(Sexp *e)
+{
+	for(; e != nil; e = e->tl){
+		if(e->inuse != 1)
+			return 0;	/* counted more than once, or static */
+		if(e->tag != Slist)
+			return (e->aflag & Abig) == 0 && (e->s == nil || e->s->ref == 1);
+		if(e->lflag & Lcompact || !unshared(e->hd))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * e, if nothing in it is shared, otherwise a copy of it, releasing e
+ */
+Sexp*
+se_unique(Sexp *e)
+{
+	Sexp *o;
+
+	if(e == nil || unshared(e))
+		return e;
+	o = se_copy(e);
+	if(o == nil)
+		return nil;
+	se_free(e);
+	return o;
+}
+
 /*
  * binary data
  */
 
-static String*
+String*
 _b_new(void *a, uint alen)
 {
 	String *b;
@@ -1089,24 +2393,6 @@ b_unique(String *b)
 	return n;
 }
 
-static uchar*
-basedec(Rd *rd, int (*f)(uchar*, int, char*, int), String *s, uint *length)
-{
-	uchar *b;
-	int lim;
-
-	lim = s_len(s)*3/4+1;
-	b = ck(rd, malloc(lim));
-	lim = f(b, lim-1, s_to_c(s), s_len(s));
-	if(lim < 0){
-		free(b);
-		synerr(rd, "corrupt encoded data", Here);
-	}
-	b[lim] = 0;
-	*length = lim;
-	return b;
-}
-
 static void*
 ck(Rd *rd, void *a)
 {
@@ -8,25 +8,109 @@
  */
 
 typedef struct Sexp Sexp;
+typedef struct Sefeed Sefeed;
+typedef struct Sepat Sepat;
+typedef struct Sebuild Sebuild;
+typedef struct Sebatch Sebatch;
+typedef struct Secursor Secursor;
+typedef struct Seopt Seopt;
+typedef struct Sebig Sebig;
+typedef struct Secache Secache;
+typedef struct Secachestat Secachestat;
+typedef struct Sesnap Sesnap;
+typedef struct Sepool Sepool;
+typedef struct Secoll Secoll;
+typedef struct Seterm Seterm;
+typedef struct Sedispatch Sedispatch;
+typedef struct Seop Seop;
 
 enum{
 	Sstring,
 	Sbinary,
 	Slist,
+
+	Ninline=	16,	/* atoms shorter than this are kept in the node */
+	Sstatic=	-1,	/* Sexp.inuse of a node that is never freed */
+
+	/* Seopt.big */
+	Bigload=	0,	/* read into memory like any other atom */
+	Bigsink,	/* pass to Seopt.sink */
+	Bigspill,	/* append to Seopt.spill, to be read again when needed */
+	Bigref,	/* leave in the input, to be read again when needed */
+
+	/* se_scan results */
+	Scanonical=	1,
+	Sadvanced,
+	Stransport,
+
+	/* se_scan flags */
+	Smore=	1<<0,	/* more input may follow */
+	Sonlycanon=	1<<1,	/* accept only canonical form */
+};
+
+/*
+ * parsing options
+ */
+struct Seopt {
+	vlong	maxatom;	/* longest atom accepted; 0 for the default */
+	vlong	bigatom;	/* verbatim atoms at least this long are big; 0 for none */
+	int	big;	/* what to do with them */
+	Sexp*	(*sink)(void*, uchar*, long);
+	void*	sinkarg;
+	int	spill;	/* file descriptor for Bigspill */
+	vlong	maxnodes;	/* nodes made; 0 for no limit */
+	vlong	maxbytes;	/* bytes in all atoms; 0 for no limit */
+	vlong	maxinput;	/* bytes of input read; 0 for no limit */
+	int	maxdepth;	/* lists and transport encodings nested; 0 for the default */
+	int	utf8;	/* valid UTF-8 in verbatim, hex and base64 atoms is text, not binary */
+};
+
+struct Seterm {	/* se_collfind: an atom at a path */
+	char*	path;
+	char*	val;
+	uint	len;
+};
+
+struct Seop {	/* se_dispatchopen: a list's operator and its function */
+	char*	name;
+	int	(*fn)(Sexp*, void*);
+};
+
+struct Secachestat {
+	vlong	hits;
+	vlong	misses;
+	vlong	evictions;
+	vlong	bytes;	/* charged for entries held */
+	int	entries;
 };
 
 struct Sexp {
+#ifdef __cplusplus
+	Lock	lk;	/* see sexp.hh */
+#else
 	Lock;
-	int	inuse;
+#endif
+	long	inuse;	/* changed by ainc and adec */
 	int	tag;
+	uint	hash;	/* private: cached se_hash, or 0 */
 	union{
 		struct{	/* atom (Sstring or Sbinary) */
-			String*	s;	/* Sstring */
+			String*	s;	/* value, or nil if only in inl */
 			String*	hint;
+			union{
+				vlong	num;	/* value of a numeric atom */
+				Sebig*	big;	/* private: where a big atom lies */
+			};
+			uchar	aflag;	/* private */
+			uchar	ninl;
+			char	inl[Ninline];	/* small value, null-terminated */
 		};
 		struct{	/* list element */
 			Sexp*	hd;	/* datum, or nil for empty list */
 			Sexp*	tl;	/* further Slist, or nil */
+			uchar*	pk;	/* private: cached canonical form, or nil */
+			uint	npk;	/* private: its length, or 0 */
+			uchar	lflag;	/* private */
 		};
 	};
 };
@@ -38,16 +122,35 @@ String*	b_unique(String*);
 Sexp*	se_string(String*);
 Sexp*	se_str(char*);
 Sexp*	se_data(uchar*, uint);
+Sexp*	se_int(int);
+Sexp*	se_vlong(vlong);
 Sexp*	se_binary(String*);
 Sexp*	se_cons(Sexp*, Sexp*);
 Sexp*	se_list(Sexp*, ...);	/* bad idea? */
 Sexp*	se_form(char*, Sexp*, ...);
 Sexp*	se_parse(char*, char**);
 Sexp*	se_unpack(char*, uint, char**);
+Sexp*	se_unpackopt(char*, uint, char**, Seopt*);
+int	se_scan(char*, uint, char**, int);
+Secache*	se_cacheopen(vlong);
+Sexp*	se_cacheunpack(Secache*, char*, uint, char**);
+Sexp*	se_cacheparse(Secache*, char*, char**);
+void	se_cachestat(Secache*, Secachestat*);
+void	se_cacheclose(Secache*);
 String*	se_text(Sexp*);
 uint	se_packedsize(Sexp*);
 uint	se_pack(uchar*, uint, Sexp*);
+void	se_packcache(Sexp*);
 String*	se_b64text(Sexp*);
+int	se_packv(Sexp**, int, IOchunk*, int, uchar*, uint*);
+long	se_writev(int, Sexp**, int);
+uchar*	se_batch(Sexp**, int, uint*);
+Sebatch*	se_batchopen(uchar*, uint);
+int	se_batchlen(Sebatch*);
+Sexp*	se_batchshape(Sebatch*);
+Sexp*	se_batchget(Sebatch*, int);
+char*	se_batchval(Sebatch*, int, int, uint*);
+void	se_batchclose(Sebatch*);
 Sexp*	se_incref(Sexp*);
 Sexp*	se_unique(Sexp*);
 void	se_free(Sexp*);
@@ -62,9 +165,64 @@ char*	se_op(Sexp*);		/* string value of head of list, if string */
 Sexp*	se_args(Sexp*);	/* list of elements following op */
 int	se_eq(Sexp*, Sexp*);	/* recursive comparison */
 Sexp*	se_copy(Sexp*);	/* recursive copy */
+Sexp*	se_compact(Sexp*);
+uint	se_hash(Sexp*);
+Sexp*	se_diff(Sexp*, Sexp*);
+Sexp*	se_patch(Sexp*, Sexp*);
+Secursor*	se_cursor(Sexp*);
+Sexp*	se_at(Secursor*);
+Sexp*	se_down(Secursor*);
+Sexp*	se_next(Secursor*);
+Sexp*	se_up(Secursor*);
+void	se_freecursor(Secursor*);
+int	se_walk(Sexp*, int (*)(Sexp*, void*), int (*)(Sexp*, void*), void*);
+Sesnap*	se_snapopen(Sexp*);
+void	se_publish(Sesnap*, Sexp*);
+Sexp*	se_snapshot_begin(Sesnap*);
+void	se_snapshot_end(Sesnap*);
+void	se_snapsync(Sesnap*);
+void	se_snapclose(Sesnap*);
+Sepool*	se_poolopen(int);
+void	se_poolclose(Sepool*);
+int	se_peq(Sepool*, Sexp*, Sexp*);
+Sexp*	se_pcopy(Sepool*, Sexp*);
+void	se_pfree(Sepool*, Sexp*);
+uint	se_phash(Sepool*, Sexp*);
+Secoll*	se_collopen(char**);
+int	se_collinsert(Secoll*, Sexp*);
+int	se_collremove(Secoll*, Sexp*);
+long	se_collfind(Secoll*, Seterm*, int, Sexp***);
+void	se_collclose(Secoll*);
+Sedispatch*	se_dispatchopen(Seop*, int);
+int	se_dispatch(Sedispatch*, Sexp*, void*);
+void	se_dispatchclose(Sedispatch*);
 String*	se_asdata(Sexp*);
 String*	se_astext(Sexp*);
+char*	se_atom(Sexp*, uint*);
+vlong	se_atomlen(Sexp*);
+long	se_atomread(Sexp*, void*, long, vlong);
+int	se_asint(Sexp*, int*);
+int	se_asvlong(Sexp*, vlong*);
+
+Sefeed*	se_feedopen(void);
+long	se_feed(Sefeed*, void*, long, Sexp**);
+void	se_feedclose(Sefeed*);
+
+Sepat*	se_compile(char*);
+int	se_match(Sepat*, Sexp*, ...);
+int	se_matchunpack(Sepat*, char*, uint, char**, ...);
+void	se_freepat(Sepat*);
+
+Sebuild*	se_builder(void);
+int	se_push(Sebuild*, Sexp*);
+int	se_pushstr(Sebuild*, char*);
+int	se_pushdata(Sebuild*, uchar*, uint);
+int	se_open(Sebuild*);
+int	se_close(Sebuild*);
+Sexp*	se_finish(Sebuild*);
 
 #ifdef BGETC
+long	se_writeb64(Biobuf*, Sexp*);
 Sexp*	se_read(Biobuf*);
+Sexp*	se_readopt(Biobuf*, char*, uint, Seopt*);
 #endif
@@ -0,0 +1,265 @@
+#include <u.h>
+#include <libc.h>
+#include <String.h>
+#include "sexp.h"
+#include "impl.h"
+
+/*
+ * a current tree that readers use without locks or reference counts,
+ * replaced by a writer from time to time.
+ * reclamation is by epoch: a reader notes the global epoch when it starts,
+ * a replaced tree is retired with the epoch that followed its replacement,
+ * and is freed once every reader still reading started at that epoch or later.
+ */
+
+typedef struct Reader Reader;
+typedef struct Retired Retired;
+
+struct Reader {	/* per-process */
+	long	epoch;	/* epoch when reading began, plus one; 0 when not reading */
+	int	nest;
+	int	pid;	/* its owner: a child made by rfork inherits the parent's slot */
+	Reader*	next;
+};
+
+struct Retired {
+	Sexp*	e;
+	long	epoch;	/* readers from this epoch on can't see e (plus one, as in Reader) */
+	Retired*	next;
+};
+
+struct Sesnap {
+	Lock;	/* writers */
+	Sexp*	cur;
+	Retired*	old;
+};
+
+static struct {
+	Lock;
+	Reader*	all;
+	void**	priv;
+	long	epoch;
+} rd;
+
+/* whether process pid still exists */
+static int
+alive(int pid)
+{
+	char buf[32];
+	Dir *d;
+
+	snprint(buf, sizeof buf, "/proc/%d/status", pid);
+	d = dirstat(buf);
+	if(d == nil)
+		return 0;
+	free(d);
+	return 1;
+}
+
+/*
+ * a record for a process new to rd: its own (left by an earlier process with its pid,
+ * which must have exited), one whose owner has exited, or a new one.
+ * so the records number no more than the processes alive at once.
+ */
+static Reader*
+claim(int pid)
+{
+	Reader *r;
+
+	lock(&rd);
+	for(r = rd.all; r != nil; r = r->next)
+		if(r->pid == pid)
+			break;
+	if(r == nil)
+		for(r = rd.all; r != nil; r = r->next)
+			if(!alive(r->pid))
+				break;
+	if(r != nil){
+		r->pid = pid;
+		r->nest = 0;
+		r->epoch = 0;	/* its owner may have exited while reading */
+		unlock(&rd);
+		return r;
+	}
+	r = mallocz(sizeof(*r), 1);
+	if(r == nil){
+		unlock(&rd);
+		return nil;
+	}
+	r->pid = pid;
+	r->next = rd.all;
+	coherence();
+	rd.all = r;
+	unlock(&rd);
+	return r;
+}
+
+static Reader*
+reader(void)
+{
+	Reader *r;
+	int pid;
+
+	if(rd.priv == nil){
+		lock(&rd);
+		if(rd.priv == nil)
+			rd.priv = privalloc();
+		unlock(&rd);
+	}
+	r = *rd.priv;
+	pid = getpid();
+	if(r == nil || r->pid != pid){
+		r = claim(pid);
+		if(r == nil)
+			return nil;
+		*rd.priv = r;
+	}
+	return r;
+}
+
+/*
+ * the tree in s, which stays valid until the matching se_snapshot_end;
+ * it must not be changed, and should be se_incref'd to keep it longer
+ */
+Sexp*
+se_snapshot_begin(Sesnap *s)
+{
+	Reader *r;
+
+	r = reader();
+	if(r == nil){
+		werrstr("se_snapshot_begin: out of memory");
+		return nil;
+	}
+	if(r->nest++ == 0){
+		r->epoch = rd.epoch+1;
+		coherence();
+	}
+	return *(Sexp* volatile*)&s->cur;
+}
+
+void
+se_snapshot_end(Sesnap *s)
+{
+	Reader *r;
+
+	USED(s);
+	r = reader();
+	if(r == nil || r->nest == 0)
+		return;	/* the bracket began in the parent */
+	coherence();
+	if(--r->nest == 0)
+		r->epoch = 0;
+}
+
+/* the earliest epoch at which a current reader started */
+static long
+oldest(void)
+{
+	Reader *r;
+	long e, m;
+
+	coherence();
+	m = 0;
+	for(r = rd.all; r != nil; r = r->next){
+		e = r->epoch;
+		if(e != 0 && (m == 0 || e < m))
+			m = e;
+	}
+	return m;
+}
+
+/* called with s locked */
+static void
+reclaim(Sesnap *s)
+{
+	Retired **l, *x;
+	long m;
+
+	m = oldest();
+	for(l = &s->old; (x = *l) != nil;){
+		if(m == 0 || x->epoch <= m){
+			*l = x->next;
+			se_free(x->e);
+			free(x);
+		}else
+			l = &x->next;
+	}
+}
+
+Sesnap*
+se_snapopen(Sexp *e)
+{
+	Sesnap *s;
+
+	s = mallocz(sizeof(*s), 1);
+	if(s == nil)
+		return nil;
+	s->cur = e;
+	return s;
+}
+
+/*
+ * make e, which now belongs to s, the current tree.
+ * the one it replaces is freed when no reader can still be using it.
+ */
+void
+se_publish(Sesnap *s, Sexp *e)
+{
+	Sexp *old;
+	Retired *x;
+	long epoch;
+
+	lock(s);
+	old = s->cur;
+	s->cur = e;
+	coherence();
+	epoch = ainc(&rd.epoch)+1;
+	if(old != nil){
+		x = malloc(sizeof(*x));
+		if(x == nil){
+			/* nowhere to keep it: wait until it's free of readers */
+			while(oldest() != 0 && oldest() < epoch)
+				sleep(0);
+			se_free(old);
+		}else{
+			x->e = old;
+			x->epoch = epoch;
+			x->next = s->old;
+			s->old = x;
+		}
+	}
+	reclaim(s);
+	unlock(s);
+}
+
+/*
+ * wait until all trees replaced in s have been freed
+ */
+void
+se_snapsync(Sesnap *s)
+{
+	lock(s);
+	for(;;){
+		reclaim(s);
+		if(s->old == nil)
+			break;
+		unlock(s);
+		sleep(0);
+		lock(s);
+	}
+	unlock(s);
+}
+
+/*
+ * free s and its trees, once no reader is using them
+ */
+void
+se_snapclose(Sesnap *s)
+{
+	if(s == nil)
+		return;
+	se_publish(s, nil);
+	se_snapsync(s);
+	free(s);
+}
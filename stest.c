@@ -5,13 +5,1338 @@
 #include "sexprs.h"
 
 Biobuf	bin;
+int	nfail;
+
+void
+check(char *what, char *arg, int ok)
+{
+	print("%s %s: %s\n", what, arg, ok? "ok": "FAIL");
+	if(!ok)
+		nfail++;
+}
+
+Sexp*
+parse(char *s)
+{
+	char *es;
+	Sexp *e;
+
+	e = se_parse(s, &es);
+	if(e == nil)
+		sysfatal("can't parse %s: %r", s);
+	return e;
+}
+
+/* element i of list e */
+Sexp*
+nth(Sexp *e, int i)
+{
+	for(e = se_els(e); e != nil && i > 0; i--)
+		e = e->tl;
+	return se_hd(e);
+}
+
+/* the expression in the n bytes at a, given to se_feed one byte at a time */
+Sexp*
+fed(char *a, long n)
+{
+	Sefeed *f;
+	Sexp *e, *x;
+	long i;
+
+	f = se_feedopen();
+	if(f == nil)
+		return nil;
+	e = nil;
+	for(i = 0; i <= n; i++){
+		if(se_feed(f, a+i, i < n, &x) < 0){
+			se_free(e);
+			e = nil;
+			break;
+		}
+		if(x != nil){
+			if(e != nil){	/* more than one */
+				se_free(x);
+				se_free(e);
+				e = nil;
+				break;
+			}
+			e = x;
+		}
+	}
+	se_feedclose(f);
+	return e;
+}
+
+/* whether e is read back the same from s when fed a byte at a time */
+int
+fedeq(Sexp *e, char *s, long n)
+{
+	Sexp *x;
+	int r;
+
+	x = fed(s, n);
+	r = x != nil && se_eq(e, x);
+	se_free(x);
+	return r;
+}
+
+/* the n bytes at a in transport encoding, broken by white space every w characters if w > 0 */
+char*
+transport(char *a, int n, int w)
+{
+	char *b, *t;
+	int i, k, m;
+
+	b = malloc((n/3+1)*4+1);
+	m = enc64(b, (n/3+1)*4+1, (uchar*)a, n);
+	t = malloc(m + (w > 0? m/w*2: 0) + 3);
+	k = 0;
+	t[k++] = '{';
+	for(i = 0; i < m; i++){
+		if(w > 0 && i > 0 && i%w == 0){
+			t[k++] = '\n';
+			t[k++] = ' ';
+		}
+		t[k++] = b[i];
+	}
+	t[k++] = '}';
+	t[k] = 0;
+	free(b);
+	return t;
+}
+
+/* transport encoding read and written on the fly */
+void
+transports(void)
+{
+	Biobuf bio;
+	Sexp *e, *x, *w;
+	String *t, *in;
+	char *a, *p, *s, file[64];
+	long n;
+	int fd;
+
+	e = parse("(a (b c) \"a string of more than sixteen bytes\" [h]#0001#)");
+	n = se_packedsize(e);
+	a = malloc(n);
+	se_pack((uchar*)a, n, e);
+	p = transport(a, n, 4);
+	x = se_parse(p, nil);
+	check("transport", "white space", x != nil && se_eq(x, e));
+	se_free(x);
+	free(p);
+	free(a);
+
+	w = parse("(b c)");
+	in = se_b64text(w);
+	se_free(w);
+	s = smprint("(a %s)", s_to_c(in));
+	p = transport(s, strlen(s), 0);
+	x = se_parse(p, nil);
+	w = parse("(a (b c))");
+	check("transport", "nested", x != nil && se_eq(x, w));
+	se_free(w);
+	se_free(x);
+	free(p);
+	free(s);
+	s_free(in);
+
+	x = se_parse("{KGEg!!!}", nil);
+	check("transport", "bad", x == nil);
+
+	/* an atom spanning many blocks */
+	a = malloc(20000);
+	for(n = 0; n < 20000; n++)
+		a[n] = n;
+	se_free(e);
+	e = se_list(se_str("big"), se_data((uchar*)a, 20000), nil);
+	t = se_b64text(e);
+	snprint(file, sizeof file, "/tmp/stest.%d", getpid());
+	fd = create(file, ORDWR|ORCLOSE, 0600);
+	if(fd < 0)
+		sysfatal("create %s: %r", file);
+	Binit(&bio, fd, OWRITE);
+	n = se_writeb64(&bio, e);
+	Bterm(&bio);
+	p = malloc(s_len(t)+1);
+	check("writeb64", "b64text", n == s_len(t) && seek(fd, 0, 0) == 0 &&
+		readn(fd, p, n+1) == n && memcmp(p, s_to_c(t), n) == 0);
+	seek(fd, 0, 0);
+	Binit(&bio, fd, OREAD);
+	x = se_readopt(&bio, nil, 0, nil);
+	Bterm(&bio);
+	check("transport", "read", x != nil && se_eq(x, e));
+	close(fd);
+	se_free(x);
+	free(p);
+	s_free(t);
+	free(a);
+	se_free(e);
+}
+
+/* numeric atoms: their text, whether se_asvlong succeeds, and the value */
+struct {
+	char*	s;
+	int	ok;
+	vlong	v;
+} numtab[] = {
+	"0",	1,	0,
+	"-12",	1,	-12,
+	"+7",	1,	7,
+	"0x1F",	1,	31,
+	"-0X10",	1,	-16,
+	"9223372036854775807",	1,	0x7FFFFFFFFFFFFFFFLL,
+	"-9223372036854775808",	1,	-0x7FFFFFFFFFFFFFFFLL-1,
+	"0x7fffffffffffffff",	1,	0x7FFFFFFFFFFFFFFFLL,
+	"9223372036854775808",	0,	0,
+	"-9223372036854775809",	0,	0,
+	"0x8000000000000000",	0,	0,
+	"123456789012345678901234567890",	0,	0,
+	"12a",	0,	0,
+	"0x",	0,	0,
+	"0x1g",	0,	0,
+	"-",	0,	0,
+	"1.5",	0,	0,
+};
+
+/* se_asvlong and se_asint, of atoms parsed and made */
+void
+numbers(void)
+{
+	Sexp *e, *x;
+	String *t;
+	vlong v;
+	int i, k, r;
+
+	for(i = 0; i < nelem(numtab); i++){
+		e = parse(numtab[i].s);
+		x = se_str(numtab[i].s);
+		r = 1;
+		for(k = 0; k < 2; k++){	/* the second time from the value kept */
+			v = -1;
+			r &= (se_asvlong(e, &v) == 0 && v == numtab[i].v) == numtab[i].ok;
+			v = -1;
+			r &= (se_asvlong(x, &v) == 0 && v == numtab[i].v) == numtab[i].ok;
+		}
+		check("asvlong", numtab[i].s, r);
+		se_free(e);
+		se_free(x);
+	}
+	e = parse("(2147483647 -2147483648 2147483648 -2147483649 (1) \"\")");
+	for(i = 0; i < 6; i++){
+		r = se_asint(nth(e, i), &k);
+		t = se_text(nth(e, i));
+		check("asint", s_to_c(t), i < 2? r == 0 && k == (i == 0? 0x7FFFFFFF: -0x7FFFFFFF-1): r < 0);
+		s_free(t);
+	}
+	se_free(e);
+
+	e = se_vlong(-0x7FFFFFFFFFFFFFFFLL-1);
+	t = se_text(e);
+	check("asvlong", "se_vlong", se_asvlong(e, &v) == 0 && v == -0x7FFFFFFFFFFFFFFFLL-1 &&
+		strcmp(s_to_c(t), "-9223372036854775808") == 0);
+	s_free(t);
+	se_free(e);
+}
+
+/* old and new trees for se_diff and se_patch */
+char *difftab[][2] = {
+	"(a b c)",	"(x a b c)",
+	"(a b c)",	"(a x b c)",
+	"(a b c)",	"(a b c x)",
+	"(a b c)",	"(b c)",
+	"(a b c)",	"(a c)",
+	"(a b c)",	"(a b)",
+	"(a)",	"()",
+	"()",	"(a)",
+	"(a b c d e f)",	"(x b c y e)",
+	"(a (b c) d)",	"(a (b x c) d)",
+	"(a (b c) d)",	"(a b d)",
+	"(a (b (c d)) e)",	"(a (b (c)) e)",
+	"atom",	"(list)",
+};
+
+void
+diffs(void)
+{
+	Sexp *old, *new, *d, *r;
+	String *t, *t1;
+	char buf[128];
+	int i;
+
+	for(i = 0; i < nelem(difftab); i++){
+		old = parse(difftab[i][0]);
+		new = parse(difftab[i][1]);
+		snprint(buf, sizeof buf, "%s %s", difftab[i][0], difftab[i][1]);
+		d = se_diff(old, new);
+		r = se_patch(se_copy(old), d);
+		check("patch", buf, r != nil && se_eq(r, new));
+		se_free(r);
+
+		/* a shared tree is left as it was */
+		t = se_text(old);
+		r = se_patch(se_incref(old), d);
+		t1 = se_text(old);
+		check("patch shared", buf, r != nil && se_eq(r, new) && strcmp(s_to_c(t), s_to_c(t1)) == 0);
+		s_free(t);
+		s_free(t1);
+		se_free(r);
+		se_free(d);
+		se_free(old);
+		se_free(new);
+	}
+}
+
+/* the canonical form, packed whole */
+uchar*
+packed(Sexp **e, int ne, uint *np)
+{
+	uchar *a;
+	uint n, m;
+	int i;
+
+	n = 0;
+	for(i = 0; i < ne; i++)
+		n += se_packedsize(e[i]);
+	a = malloc(n+1);
+	for(m = 0, i = 0; i < ne; i++)
+		m += se_pack(a+m, n-m, e[i]);
+	*np = m;
+	return a;
+}
+
+/* trees big enough for se_packcache to keep their lists, before and after a change */
+char *cachetab[][2] = {
+	"(config (net (addr \"10.0.0.1, padded to a long atom\") (gw \"10.0.0.254, padded to a long atom\")) (users (alice admin) (bob guest)))",
+	"(config (net (addr \"10.0.0.2, padded to a long atom\") (gw \"10.0.0.254, padded to a long atom\")) (users (alice admin) (bob guest)))",
+
+	"(config (net (addr \"10.0.0.1, padded to a long atom\") (gw \"10.0.0.254, padded to a long atom\")) (users (alice admin) (bob guest)))",
+	"(config (net (addr \"10.0.0.1, padded to a long atom\") (gw \"10.0.0.254, padded to a long atom\")) (users (alice admin) (bob guest) (carol guest)))",
+
+	"(config (net (addr \"10.0.0.1, padded to a long atom\") (gw \"10.0.0.254, padded to a long atom\")) (users (alice admin) (bob guest)))",
+	"(config (net (addr \"10.0.0.1, padded to a long atom\")) (users (alice admin) (bob guest)))",
+
+	"(config (net (addr \"10.0.0.1, padded to a long atom\") (gw \"10.0.0.254, padded to a long atom\")) (users (alice admin) (bob guest)))",
+	"(config (net) (users (alice admin) (bob guest)) \"a trailing atom, also of some length\")",
+};
+
+/* whether e packs as x does */
+int
+packeq(Sexp *e, Sexp *x)
+{
+	uchar *a, *b;
+	uint n, m;
+	String *s, *t;
+	int r;
+
+	a = packed(&e, 1, &n);
+	b = packed(&x, 1, &m);
+	s = se_b64text(e);
+	t = se_b64text(x);
+	r = n == m && memcmp(a, b, n) == 0 && strcmp(s_to_c(s), s_to_c(t)) == 0;
+	free(a);
+	free(b);
+	s_free(s);
+	s_free(t);
+	return r;
+}
+
+/* what se_packcache keeps is discarded where se_patch changes a tree, shared or not */
+void
+packcaches(void)
+{
+	Sexp *old, *new, *ref, *d, *r;
+	char buf[16];
+	int i;
+
+	for(i = 0; i < nelem(cachetab); i++){
+		old = parse(cachetab[i][0]);
+		new = parse(cachetab[i][1]);
+		ref = parse(cachetab[i][0]);
+		snprint(buf, sizeof buf, "%d", i);
+		se_packcache(old);
+		check("packcache", buf, packeq(old, ref) && packeq(old, ref) && old->pk != nil);
+		d = se_diff(old, new);
+		r = se_patch(se_incref(old), d);
+		check("packcache shared", buf, r != nil && packeq(r, new) && packeq(old, ref));
+		se_free(r);
+		r = se_patch(old, d);
+		check("packcache patch", buf, r != nil && packeq(r, new));
+		se_free(r);
+		se_free(d);
+		se_free(new);
+		se_free(ref);
+	}
+}
+
+/* message i of a set of the same size */
+char*
+msg(char *buf, int n, int i)
+{
+	snprint(buf, n, "(msg %d \"a body of some length, so as to weigh more than the nodes\") rest", i);
+	return buf;
+}
+
+/* se_cacheparse shares trees from the same input, and drops the least recently used */
+void
+caches(void)
+{
+	Secache *c;
+	Secachestat st;
+	Sexp *e, *x, *m[4];
+	char buf[128], *ep, *ep1;
+	vlong per;
+	int i, r;
+
+	c = se_cacheopen(1<<20);
+	e = se_cacheparse(c, msg(buf, sizeof buf, 0), &ep);
+	x = se_cacheparse(c, msg(buf, sizeof buf, 0), &ep1);
+	se_cachestat(c, &st);
+	check("cache", "hit", e != nil && x == e && ep1 == ep && strcmp(ep, " rest") == 0 &&
+		st.hits == 1 && st.misses == 1 && st.entries == 1);
+	se_free(x);
+	x = se_cacheparse(c, msg(buf, sizeof buf, 1), nil);
+	se_cachestat(c, &st);
+	check("cache", "miss", x != nil && x != e && !se_eq(x, e) && st.misses == 2 && st.entries == 2);
+	se_free(x);
+	x = se_cacheparse(c, "(bad", nil);
+	se_cachestat(c, &st);
+	check("cache", "bad", x == nil && st.entries == 2);
+	per = st.bytes/2;
+	se_cacheclose(c);
+	x = parse(msg(buf, sizeof buf, 0));
+	check("cache", "close", se_eq(e, x));
+	se_free(x);
+	se_free(e);
+
+	/* room for three */
+	c = se_cacheopen(3*per + per/2);
+	for(i = 0; i < 3; i++)
+		m[i] = se_cacheparse(c, msg(buf, sizeof buf, i), nil);
+	se_free(se_cacheparse(c, msg(buf, sizeof buf, 0), nil));
+	m[3] = se_cacheparse(c, msg(buf, sizeof buf, 3), nil);
+	se_cachestat(c, &st);
+	check("cache", "evict", st.entries == 3 && st.evictions == 1 && st.bytes <= 3*per + per/2);
+	r = 1;
+	for(i = 0; i < 4; i++){	/* the evicted one last, as parsing it evicts another */
+		x = se_cacheparse(c, msg(buf, sizeof buf, (i+2)%4), nil);
+		r &= (x == m[(i+2)%4]) == (i != 3);
+		se_free(x);
+	}
+	se_cachestat(c, &st);
+	check("cache", "lru", r && st.bytes <= 3*per + per/2 && st.entries == 3);
+	for(i = 0; i < 4; i++)
+		se_free(m[i]);
+	se_cacheclose(c);
+
+	c = se_cacheopen(per/2);
+	e = se_cacheparse(c, msg(buf, sizeof buf, 0), nil);
+	se_cachestat(c, &st);
+	check("cache", "too big", e != nil && st.entries == 0 && st.bytes == 0);
+	se_free(e);
+	se_cacheclose(c);
+}
+
+/* input to se_scan, its flags, the result, and where it ends (-1: anywhere) */
+struct {
+	char*	in;
+	int	flags;
+	int	r;
+	int	end;
+} scantab[] = {
+	"(3:abc[1:h]1:x())",	0,	Scanonical,	17,
+	"(3:abc)(1:b)",	0,	Scanonical,	7,
+	"(1:a)",	Sonlycanon,	Scanonical,	5,
+	"  (a b)",	0,	Sadvanced,	7,
+	"(a \"s\" #00# |YQ==| [h]x)",	0,	Sadvanced,	24,
+	"(a))",	0,	Sadvanced,	3,
+	"abc",	0,	Sadvanced,	3,
+	"{KDE6YSk=}",	0,	Stransport,	10,
+	"(3:abc",	Smore,	0,	0,
+	"  (3:ab",	Smore,	0,	2,
+	"5:abc",	Smore,	0,	0,
+	"1000000000:x",	Smore,	0,	0,
+	"(a b",	Smore,	0,	0,
+	"abc",	Smore,	0,	0,
+	"{KDE6",	Smore,	0,	0,
+	"   ",	Smore,	0,	-1,
+	"(3:abc",	0,	-1,	-1,
+	"5:abc",	0,	-1,	-1,
+	"(a b",	0,	-1,	-1,
+	"(a b)",	Sonlycanon,	-1,	-1,
+	")",	0,	-1,	0,
+	"[h](a)",	0,	-1,	3,
+};
+
+/* se_scan: forms, incomplete input and errors */
+void
+scans(void)
+{
+	char *end;
+	int i, r;
+
+	for(i = 0; i < nelem(scantab); i++){
+		end = nil;
+		r = se_scan(scantab[i].in, strlen(scantab[i].in), &end, scantab[i].flags);
+		check("scan", scantab[i].in, r == scantab[i].r &&
+			(scantab[i].end < 0 || end == scantab[i].in+scantab[i].end));
+	}
+}
+
+/* a replaced snapshot is kept while a bracket that could see it is open */
+void
+snapshots(void)
+{
+	Sesnap *s;
+	Sexp *e, *f, *g;
+
+	e = se_incref(parse("(config (a 1))"));
+	f = se_incref(parse("(config (a 2))"));
+	g = se_incref(parse("(config (a 3))"));
+	s = se_snapopen(e);
+	check("snapshot", "begin", se_snapshot_begin(s) == e);
+	se_publish(s, f);
+	check("snapshot", "nested", se_snapshot_begin(s) == f);
+	se_snapshot_end(s);
+	se_publish(s, g);
+	check("snapshot", "kept", e->inuse == 2 && f->inuse == 2);
+	se_snapshot_end(s);
+	se_snapsync(s);
+	check("snapshot", "freed", e->inuse == 1 && f->inuse == 1 && g->inuse == 2);
+	se_publish(s, se_incref(e));
+	check("snapshot", "no readers", g->inuse == 1 && e->inuse == 2);
+	se_snapclose(s);
+	check("snapshot", "close", e->inuse == 1);
+	se_free(e);
+	se_free(f);
+	se_free(g);
+}
+
+/* whether the n trees found in c with kind k and owner o are the records i, in order, that have them and pass ok */
+int
+found(Secoll *c, char *k, char *o, int (*ok)(int))
+{
+	Seterm t[2];
+	Sexp **v;
+	long n, i, j;
+	int id, r;
+
+	t[0].path = "rec/kind";
+	t[0].val = k;
+	t[0].len = strlen(k);
+	t[1].path = "rec/owner";
+	t[1].val = o;
+	t[1].len = strlen(o);
+	n = se_collfind(c, t, 2, &v);
+	if(n < 0)
+		return 0;
+	r = 1;
+	j = 0;
+	for(i = 0; i < 200 && r; i++){
+		if(i%3 != atoi(k+1) || i%5 != atoi(o+1) || !ok(i))
+			continue;
+		r = j < n && se_asint(nth(nth(v[j], 1), 1), &id) == 0 && id == i;
+		j++;
+	}
+	free(v);
+	return r && j == n;
+}
+
+int
+anyrec(int i)
+{
+	USED(i);
+	return 1;
+}
+
+int
+not7(int i)
+{
+	return i != 7;
+}
+
+int
+odd(int i)
+{
+	return i%2 == 1 && i != 7;
+}
+
+/* se_collfind intersects terms, before and after members are removed */
+void
+colls(void)
+{
+	static char *paths[] = {"rec/kind", "rec/owner", nil};
+	Secoll *c;
+	Sexp *e[200], **v;
+	Seterm t;
+	char buf[64];
+	long n;
+	int i, r;
+
+	c = se_collopen(paths);
+	for(i = 0; i < nelem(e); i++){
+		snprint(buf, sizeof buf, "(rec (id %d) (kind k%d) (owner o%d))", i, i%3, i%5);
+		e[i] = parse(buf);
+		if(se_collinsert(c, e[i]) < 0)
+			sysfatal("se_collinsert: %r");
+	}
+	check("coll", "insert twice", se_collinsert(c, e[0]) < 0);
+	check("coll", "find", found(c, "k1", "o2", anyrec) && found(c, "k0", "o0", anyrec));
+	n = se_collfind(c, nil, 0, &v);
+	check("coll", "all", n == nelem(e) && v[0] == e[0] && v[nelem(e)-1] == e[nelem(e)-1]);
+	free(v);
+	t.path = "rec/kind";
+	t.val = "k9";
+	t.len = 2;
+	check("coll", "no such value", se_collfind(c, &t, 1, &v) == 0);
+	free(v);
+	t.path = "rec/id";
+	t.val = "7";
+	t.len = 1;
+	check("coll", "not indexed", se_collfind(c, &t, 1, &v) < 0);
+
+	r = se_collremove(c, e[7]) == 0 && se_collremove(c, e[7]) < 0;
+	check("coll", "remove", r && found(c, "k1", "o2", not7));
+	r = 1;
+	for(i = 0; i < nelem(e); i += 2)	/* enough to renumber */
+		r &= se_collremove(c, e[i]) == 0;
+	check("coll", "remove many", r && found(c, "k1", "o2", odd) && found(c, "k0", "o0", odd));
+	r = se_collinsert(c, e[22]) == 0;
+	n = se_collfind(c, nil, 0, &v);
+	check("coll", "reinsert", r && n == nelem(e)/2 && v[n-1] == e[22]);
+	free(v);
+	se_collclose(c);
+	for(i = 0; i < nelem(e); i++)
+		se_free(e[i]);
+}
+
+int
+opnum(Sexp *e, void *a)
+{
+	USED(e);
+	return (int)(uintptr)a;
+}
+
+int
+opdflt(Sexp *e, void *a)
+{
+	USED(e);
+	USED(a);
+	return 1000;
+}
+
+/* se_dispatch calls the function for each operator, the default for others */
+void
+dispatches(void)
+{
+	Sedispatch *d;
+	Seop ops[101], dup[2];
+	char buf[64];
+	Sexp *e;
+	int i, r;
+
+	for(i = 0; i < 100; i++){
+		ops[i].name = smprint("op%d", i);
+		ops[i].fn = opnum;
+	}
+	d = se_dispatchopen(ops, 100);
+	r = d != nil;
+	for(i = 0; i < 100 && r; i++){
+		snprint(buf, sizeof buf, "(op%d x)", i);
+		e = parse(buf);
+		r &= se_dispatch(d, e, (void*)(uintptr)i) == i;
+		se_free(e);
+	}
+	check("dispatch", "ops", r);
+	e = parse("(op100 x)");
+	check("dispatch", "unknown", se_dispatch(d, e, nil) < 0);
+	se_free(e);
+	e = parse("op3");
+	check("dispatch", "atom", se_dispatch(d, e, (void*)3) < 0);
+	se_free(e);
+	se_dispatchclose(d);
+
+	/* with a default, anywhere in the table */
+	ops[100] = ops[50];
+	ops[50].name = nil;
+	ops[50].fn = opdflt;
+	d = se_dispatchopen(ops, 101);
+	e = parse("(op50 x)");	/* now last */
+	r = d != nil && se_dispatch(d, e, (void*)50) == 50;
+	se_free(e);
+	check("dispatch", "default", r && se_dispatch(d, nil, nil) == 1000);
+	e = parse("(op1000 x)");
+	check("dispatch", "unknown default", se_dispatch(d, e, nil) == 1000);
+	se_free(e);
+	e = parse("((op1) x)");
+	check("dispatch", "list operator", se_dispatch(d, e, nil) == 1000);
+	se_free(e);
+	se_dispatchclose(d);
+
+	dup[0].name = dup[1].name = "a";
+	dup[0].fn = dup[1].fn = opnum;
+	d = se_dispatchopen(dup, 2);
+	check("dispatch", "duplicate", d == nil);
+	for(i = 0; i < nelem(ops); i++)
+		free(ops[i].name);
+}
+
+/* se_packv and se_writev give what se_pack does, referring to large atoms where they lie */
+void
+packvs(void)
+{
+	Sexp *e[3], *big;
+	IOchunk io[64];
+	uchar *a, *b, scratch[256];
+	char *v, file[64];
+	uint n, m, ns;
+	int i, nio, fd, ref;
+
+	v = malloc(1000);
+	for(i = 0; i < 1000; i++)
+		v[i] = i;
+	big = se_data((uchar*)v, 1000);
+	free(v);
+	e[0] = se_list(se_str("data"), big, se_str("small"), nil);
+	e[1] = parse("(a ([hint]b c) \"a string of more than sixteen bytes\" ())");
+	e[2] = parse("tail");
+	se_packcache(e[1]);
+	a = packed(e, nelem(e), &n);
+	ns = sizeof scratch;
+	nio = se_packv(e, nelem(e), io, nelem(io), scratch, &ns);
+	b = malloc(n+1);
+	m = 0;
+	ref = 0;
+	for(i = 0; i < nio && m+io[i].len <= n; i++){
+		memmove(b+m, io[i].addr, io[i].len);
+		m += io[i].len;
+		ref |= io[i].addr == se_atom(big, nil);
+	}
+	check("packv", "chunks", nio > 0 && i == nio && m == n && memcmp(a, b, n) == 0 && ref);
+	ns = 8;
+	check("packv", "small scratch", se_packv(e, nelem(e), io, nelem(io), scratch, &ns) < 0);
+	ns = sizeof scratch;
+	check("packv", "few chunks", se_packv(e, nelem(e), io, 1, scratch, &ns) < 0);
+
+	snprint(file, sizeof file, "/tmp/stest.%d", getpid());
+	fd = create(file, ORDWR|ORCLOSE, 0600);
+	memset(b, 0, n);
+	check("writev", "file", fd >= 0 && se_writev(fd, e, nelem(e)) == n &&
+		seek(fd, 0, 0) == 0 && readn(fd, b, n+1) == n && memcmp(a, b, n) == 0);
+	if(fd >= 0)
+		close(fd);
+	free(a);
+	free(b);
+	for(i = 0; i < nelem(e); i++)
+		se_free(e[i]);
+}
+
+/* templates that don't compile */
+char *badpat[] = {
+	"(a",
+	"a)",
+	"(a %x)",
+	"(a %* b)",
+	"",
+	"(a) (b)",
+};
+
+/* templates, expressions, and whether they match */
+struct {
+	char*	pat;
+	char*	in;
+	int	ok;
+} matchtab[] = {
+	"(ipconfig (ipaddr %s) %*)",	"(ipconfig (ipaddr 1.2.3.4) (ipgw 5))",	1,
+	"(ipconfig (ipaddr %s) %*)",	"(ipconfig (ipaddr))",	0,
+	"(ipconfig (ipaddr %s))",	"(ipconfig (ipaddr 1.2.3.4) (ipgw 5))",	0,
+	"(ipconfig (ipaddr %s))",	"(ipconfig)",	0,
+	"(a %d)",	"(a 12)",	1,
+	"(a %d)",	"(a twelve)",	0,
+	"(a %d)",	"(a 99999999999)",	0,
+	"(a %s)",	"(a #00ff#)",	0,
+	"(a %s)",	"(a (b))",	0,
+	"(a %S)",	"(a #00ff#)",	1,
+	"(a %S)",	"(a (b))",	0,
+	"(a %e)",	"(a (b c))",	1,
+	"(a %e)",	"(a)",	0,
+	"(a [h]b)",	"(a [h]b)",	1,
+	"(a [h]b)",	"(a b)",	0,
+	"(a %*)",	"(a)",	1,
+	"(%*)",	"()",	1,
+	"()",	"()",	1,
+	"()",	"(a)",	0,
+	"atom",	"atom",	1,
+	"atom",	"(atom)",	0,
+	"(a %s %d)",	"(a x y)",	0,
+};
+
+/* free a value stored by se_matchunpack for the conversion in pattern s */
+void
+unbind(char *s, void *v)
+{
+	if(strstr(s, "%s") != nil)
+		free(v);
+	else if(strstr(s, "%S") != nil)
+		s_free(v);
+	else if(strstr(s, "%e") != nil)
+		se_free(v);
+}
+
+void
+matches(void)
+{
+	Sepat *p;
+	Sexp *e, *x;
+	String *d;
+	char buf[64*3], *a, *g, *es, *in;
+	void *v[2];
+	int i, r, fwd;
+
+	for(i = 0; i < nelem(badpat); i++){
+		p = se_compile(badpat[i]);
+		check("compile", badpat[i], p == nil);
+		se_freepat(p);
+	}
+	strcpy(buf, "(");
+	for(i = 0; i < 32; i++)
+		strcat(buf, "%e ");
+	p = se_compile(strcat(buf, ")"));
+	check("compile", "32 bindings", p != nil);
+	se_freepat(p);
+	strcpy(buf+strlen(buf)-1, "%e)");
+	p = se_compile(buf);
+	check("compile", "33 bindings", p == nil);
+	se_freepat(p);
+
+	for(i = 0; i < nelem(matchtab); i++){
+		snprint(buf, sizeof buf, "%s %s", matchtab[i].pat, matchtab[i].in);
+		p = se_compile(matchtab[i].pat);
+		e = parse(matchtab[i].in);
+		v[0] = v[1] = nil;
+		r = p != nil && se_match(p, e, &v[0], &v[1]) == matchtab[i].ok;
+		v[0] = v[1] = nil;
+		r &= p != nil && se_matchunpack(p, matchtab[i].in, strlen(matchtab[i].in), &es, &v[0], &v[1]) == matchtab[i].ok;
+		r &= es == matchtab[i].in+strlen(matchtab[i].in);
+		if(matchtab[i].ok)
+			unbind(matchtab[i].pat, v[0]);
+		else
+			r &= v[0] == nil && v[1] == nil;	/* nothing left stored */
+		check("match", buf, r);
+		se_freepat(p);
+		se_free(e);
+	}
+
+	/* the values bound */
+	in = "(ipconfig (ipaddr 1.3.5.6) (ipgw 3.4.5.7) (ipforwarding 0) (key #0001ff#) (x (y z)))";
+	e = parse(in);
+	p = se_compile("(ipconfig (ipaddr %s) (ipgw %s) (ipforwarding %d) (key %S) (x %e))");
+	r = se_match(p, e, &a, &g, &fwd, &d, &x);
+	check("match", "values", r == 1 && strcmp(a, "1.3.5.6") == 0 && strcmp(g, "3.4.5.7") == 0 &&
+		fwd == 0 && s_len(d) == 3 && memcmp(s_to_c(d), "\0\1\377", 3) == 0 && x == se_hd(se_tl(nth(e, 5))));
+	r = se_matchunpack(p, in, strlen(in), &es, &a, &g, &fwd, &d, &x);
+	check("matchunpack", "values", r == 1 && strcmp(a, "1.3.5.6") == 0 && strcmp(g, "3.4.5.7") == 0 &&
+		fwd == 0 && s_len(d) == 3 && memcmp(s_to_c(d), "\0\1\377", 3) == 0 && se_eq(x, se_hd(se_tl(nth(e, 5)))));
+	if(r == 1){
+		free(a);
+		free(g);
+		s_free(d);
+		se_free(x);
+	}
+	se_freepat(p);
+	se_free(e);
+
+	p = se_compile("(a %s)");
+	in = "(a \"unterminated)";
+	v[0] = nil;
+	check("matchunpack", "syntax", se_matchunpack(p, in, strlen(in), &es, &v[0]) < 0 && es == in && v[0] == nil);
+	se_freepat(p);
+}
+
+/* se_walk's callbacks: the text of the tree, eliding lists whose operator is skip */
+int
+pre(Sexp *e, void *a)
+{
+	String *s;
+
+	s = a;
+	if(e->tag != Slist){
+		if(strcmp(se_atom(e, nil), "stop") == 0)
+			return -2;
+		s_append(s, se_atom(e, nil));
+		s_putc(s, ' ');
+		return 0;
+	}
+	s_putc(s, '(');
+	if(se_op(e) != nil && strcmp(se_op(e), "skip") == 0){
+		s_append(s, "...");
+		return 1;
+	}
+	return 0;
+}
+
+int
+post(Sexp *e, void *a)
+{
+	if(e->tag == Slist)
+		s_append(a, ")");
+	return 0;
+}
+
+/* the depth of e, counted by post */
+int
+depth(Sexp *e, void *a)
+{
+	int *d;
+
+	d = a;
+	if(e->tag == Slist)
+		d[0]++;
+	else
+		d[1] = d[0];
+	return 0;
+}
+
+/* traversal by cursor and by se_walk, in order, skipping, stopping, and deep */
+void
+traversal(void)
+{
+	Secursor *c;
+	Sexp *e, *x;
+	String *s;
+	int ok, i, d[2];
+
+	e = parse("(a (b c) (skip d e) () f)");
+	c = se_cursor(e);
+	ok = se_at(c) == e && se_next(c) == nil && se_up(c) == nil;
+	ok &= (x = se_down(c)) != nil && strcmp(se_atom(x, nil), "a") == 0 && se_down(c) == nil;
+	ok &= se_next(c) == nth(e, 1) && strcmp(se_atom(se_down(c), nil), "b") == 0;
+	ok &= strcmp(se_atom(se_next(c), nil), "c") == 0 && se_next(c) == nil && strcmp(se_atom(se_at(c), nil), "c") == 0;
+	ok &= se_up(c) == nth(e, 1) && se_next(c) == nth(e, 2) && se_next(c) == nth(e, 3);
+	ok &= se_down(c) == nil && se_next(c) == nth(e, 4) && se_next(c) == nil;
+	ok &= se_up(c) == e && se_up(c) == nil && se_at(c) == e;
+	se_freecursor(c);
+	check("cursor", "moves", ok);
+
+	s = s_new();
+	i = se_walk(e, pre, post, s);
+	s_terminate(s);
+	check("walk", "order", i == 0 && strcmp(s_to_c(s), "(a (b c )(...)()f )") == 0);
+	s_reset(s);
+	se_free(e);
+	e = parse("(a (b stop c) d)");
+	i = se_walk(e, pre, post, s);
+	s_terminate(s);
+	check("walk", "stop", i == -2 && strcmp(s_to_c(s), "(a (b ") == 0);
+	s_free(s);
+	se_free(e);
+
+	/* deeper than recursion would go */
+	e = se_str("x");
+	for(i = 0; i < 100000; i++)
+		e = se_cons(e, nil);
+	d[0] = d[1] = 0;
+	check("walk", "deep", se_walk(e, depth, nil, d) == 0 && d[1] == 100000);
+	c = se_cursor(e);
+	for(i = 0; se_down(c) != nil; i++)
+		{}
+	ok = i == 100000 && se_up(c) != nil;
+	for(i = 1; se_up(c) != nil; i++)
+		{}
+	check("cursor", "deep", ok && i == 100000 && se_at(c) == e);
+	se_freecursor(c);
+	while(e->tag == Slist){
+		x = e->hd;
+		e->hd = nil;
+		se_free(e);
+		e = x;
+	}
+	se_free(e);
+}
+
+/* bytes from malloc, for the builder to adopt */
+void*
+mdup(void *a, uint n)
+{
+	void *p;
+
+	p = malloc(n+1);
+	memmove(p, a, n);
+	((char*)p)[n] = 0;
+	return p;
+}
+
+/* trees built an element at a time, and builders misused */
+void
+builds(void)
+{
+	Sebuild *b;
+	Sexp *e, *x;
+	int i, v, ok;
+
+	b = se_builder();
+	se_open(b);
+	se_pushstr(b, mdup("cert", 4));
+	se_open(b);
+	se_pushstr(b, mdup("subject", 7));
+	se_pushstr(b, mdup("a string longer than an inline atom", 35));
+	se_close(b);
+	se_pushdata(b, mdup("\0\1\2", 3), 3);
+	se_pushdata(b, mdup("binary data longer than sixteen\0", 32), 32);
+	se_push(b, parse("(already (made))"));
+	se_open(b);
+	se_close(b);
+	se_close(b);
+	e = se_finish(b);
+	x = parse("(cert (subject \"a string longer than an inline atom\") #000102# |YmluYXJ5IGRhdGEgbG9uZ2VyIHRoYW4gc2l4dGVlbgA=| (already (made)) ())");
+	check("build", "tree", e != nil && se_eq(e, x));
+	se_free(e);
+	se_free(x);
+
+	b = se_builder();
+	se_open(b);
+	for(i = 0; i < 10000; i++)
+		se_push(b, se_int(i));
+	se_close(b);
+	e = se_finish(b);
+	ok = e != nil && se_len(e) == 10000;
+	for(x = e, i = 0; ok && x != nil; x = x->tl, i++)
+		ok = se_asint(x->hd, &v) == 0 && v == i;
+	check("build", "long", ok && i == 10000);
+	se_free(e);
+
+	/* errors, after which what is given is freed */
+	b = se_builder();
+	ok = se_close(b) < 0 && se_pushstr(b, mdup("x", 1)) < 0 && se_open(b) < 0;
+	check("build", "close without open", ok && se_finish(b) == nil);
+	b = se_builder();
+	se_open(b);
+	se_push(b, parse("(a b)"));
+	check("build", "unclosed", se_finish(b) == nil);
+	b = se_builder();
+	se_push(b, parse("a"));
+	ok = se_push(b, parse("b")) < 0 && se_pushdata(b, mdup("data", 4), 4) < 0;
+	check("build", "two expressions", ok && se_finish(b) == nil);
+	b = se_builder();
+	se_open(b);
+	check("build", "nil", se_push(b, nil) < 0 && se_close(b) < 0 && se_finish(b) == nil);
+	check("build", "empty", se_finish(se_builder()) == nil);
+}
+
+/* compact trees, and references into them that outlive the root */
+void
+compacts(void)
+{
+	Sexp *e, *new, *c, *d, *r, *x;
+	String *t, *t1;
+	int ok;
+
+	e = parse("(cert (issuer (hash md5 |aGVsbG8gdGhlcmUgc2FpbG9y|)) (subject [text/plain]\"a string in the block\") 12345)");
+	new = parse("(cert (issuer (hash sha1 |aGVsbG8gdGhlcmUgc2FpbG9y|)) (subject [text/plain]\"a string in the block\") 12345 (tag *))");
+	d = se_diff(e, new);
+
+	c = se_compact(e);
+	check("compact", "eq", c != nil && se_eq(c, e) && se_hash(c) == se_hash(e));
+	x = se_unique(se_incref(c));
+	check("compact", "unique", x != nil && x != c && se_eq(x, e));
+	se_free(x);
+	se_free(c);
+
+	c = se_compact(e);
+	r = se_patch(c, d);
+	check("compact", "patch", r != nil && se_eq(r, new));
+	se_free(r);
+
+	/* the patched tree shares cells of the block, and holds it once the root is gone */
+	c = se_compact(e);
+	t = se_text(c);
+	r = se_patch(se_incref(c), d);
+	t1 = se_text(c);
+	ok = strcmp(s_to_c(t), s_to_c(t1)) == 0;
+	se_free(c);
+	check("compact", "patch shared", ok && r != nil && se_eq(r, new));
+	s_free(t);
+	s_free(t1);
+	se_free(r);
+
+	/* a subtree, and a script referring to subtrees */
+	c = se_compact(e);
+	x = se_incref(se_hd(se_tl(c)));
+	se_free(c);
+	check("compact", "subtree", se_eq(x, se_hd(se_tl(e))));
+	se_free(x);
+	c = se_compact(new);
+	se_free(d);
+	d = se_diff(e, c);
+	se_free(c);
+	r = se_patch(se_copy(e), d);
+	check("compact", "diff", r != nil && se_eq(r, new));
+	se_free(r);
+
+	se_free(d);
+	se_free(e);
+	se_free(new);
+}
+
+/*
+ * records with a dictionary-coded column (host), columns of lengths then values
+ * (msg, bin), atoms whose hints vary, kept as subtrees (x), and an odd record
+ */
+void
+batches(void)
+{
+	Sexp *e[40], *x, *l;
+	Sebatch *b;
+	uchar *a;
+	char buf[128], *v;
+	uint n, m;
+	int i, ok, col[4];
+
+	for(i = 0; i < nelem(e); i++){
+		if(i == 7)
+			snprint(buf, sizeof buf, "(other [h]thing)");
+		else
+			snprint(buf, sizeof buf, "(log (host h%d) (msg \"message %d\") (bin #00%.2xff#) (x %sv%d))",
+				i%3, i, i, i%2? "[hint]": "", i);
+		e[i] = parse(buf);
+	}
+	a = se_batch(e, nelem(e), &n);
+	b = a != nil? se_batchopen(a, n): nil;
+	check("batch", "open", b != nil && se_batchlen(b) == nelem(e));
+	if(b == nil)
+		return;
+	ok = 1;
+	for(i = 0; i < nelem(e); i++){
+		x = se_batchget(b, i);
+		ok &= se_eq(x, e[i]);
+		se_free(x);
+	}
+	check("batch", "records", ok);
+
+	/* the columns, from the shape (log (host col) (msg col) (bin col) (x col)) */
+	x = se_batchshape(b);
+	i = 0;
+	for(l = se_args(x); l != nil && i < nelem(col); l = l->tl)
+		if(se_asint(se_hd(se_tl(l->hd)), &col[i]) == 0)
+			i++;
+	se_free(x);
+	check("batch", "shape", i == nelem(col));
+	if(i != nelem(col))
+		return;
+	ok = 1;
+	for(i = 0; i < nelem(e); i++){
+		if(i == 7)
+			continue;
+		snprint(buf, sizeof buf, "h%d", i%3);
+		v = se_batchval(b, col[0], i, &m);
+		ok &= v != nil && m == strlen(buf) && memcmp(v, buf, m) == 0;
+		snprint(buf, sizeof buf, "message %d", i);
+		v = se_batchval(b, col[1], i, &m);
+		ok &= v != nil && m == strlen(buf) && memcmp(v, buf, m) == 0;
+		v = se_batchval(b, col[2], i, &m);
+		ok &= v != nil && m == 3 && (uchar)v[0] == 0 && (uchar)v[1] == i && (uchar)v[2] == 0xFF;
+		ok &= se_batchval(b, col[3], i, &m) == nil;
+	}
+	ok &= se_batchval(b, 0, 7, &m) == nil;	/* the odd record's column holds trees */
+	check("batch", "values", ok);
+	se_batchclose(b);
+	free(a);
+	for(i = 0; i < nelem(e); i++)
+		se_free(e[i]);
+
+	a = se_batch(nil, 0, &n);
+	b = a != nil? se_batchopen(a, n): nil;
+	check("batch", "empty", b != nil && se_batchlen(b) == 0);
+	se_batchclose(b);
+	free(a);
+}
+
+/* inputs exactly at a limit in Seopt, and just over it */
+struct {
+	char*	what;
+	vlong	lim;
+	char*	in;
+	int	ok;
+} limtab[] = {
+	"maxdepth",	3,	"(((a)))",	1,
+	"maxdepth",	3,	"((((a))))",	0,
+	"maxdepth",	2,	"{KDE6YSk=}",	1,	/* the encoding and the list */
+	"maxdepth",	1,	"{KDE6YSk=}",	0,
+	"maxatom",	5,	"hello",	1,
+	"maxatom",	5,	"hellos",	0,
+	"maxatom",	5,	"5:hello",	1,
+	"maxatom",	5,	"6:hellos",	0,
+	"maxatom",	5,	"\"hello\"",	1,
+	"maxatom",	5,	"\"hellos\"",	0,
+	"maxatom",	5,	"#68656c6c6f#",	1,
+	"maxatom",	5,	"#68656c6c6f73#",	0,
+	"maxatom",	5,	"|aGVsbG8=|",	1,
+	"maxatom",	5,	"|aGVsbG9z|",	0,
+	"maxnodes",	7,	"(a (b c))",	1,
+	"maxnodes",	6,	"(a (b c))",	0,
+	"maxbytes",	4,	"(ab cd)",	1,
+	"maxbytes",	3,	"(ab cd)",	0,
+	"maxinput",	7,	"(ab cd)",	1,
+	"maxinput",	6,	"(ab cd)",	0,
+};
+
+void
+limits(void)
+{
+	Seopt o;
+	Sexp *e;
+	char buf[64], *es;
+	int i;
+
+	for(i = 0; i < nelem(limtab); i++){
+		memset(&o, 0, sizeof(o));
+		if(strcmp(limtab[i].what, "maxdepth") == 0)
+			o.maxdepth = limtab[i].lim;
+		else if(strcmp(limtab[i].what, "maxatom") == 0)
+			o.maxatom = limtab[i].lim;
+		else if(strcmp(limtab[i].what, "maxnodes") == 0)
+			o.maxnodes = limtab[i].lim;
+		else if(strcmp(limtab[i].what, "maxbytes") == 0)
+			o.maxbytes = limtab[i].lim;
+		else
+			o.maxinput = limtab[i].lim;
+		e = se_unpackopt(limtab[i].in, strlen(limtab[i].in), &es, &o);
+		snprint(buf, sizeof buf, "%s %lld %s", limtab[i].what, limtab[i].lim, limtab[i].in);
+		check("limit", buf, (e != nil) == limtab[i].ok);
+		se_free(e);
+	}
+}
+
+/* Seopt.sink: counts the bytes of a big atom, and puts the count in its place */
+Sexp*
+sink(void *a, uchar *p, long n)
+{
+	vlong *t;
+
+	t = a;
+	if(p == nil)
+		return *t > 0? se_vlong(*t): nil;
+	*t += n;
+	return nil;
+}
+
+/* big atoms passed to a sink, spilled to a file and referred to in the input */
+void
+bigatoms(void)
+{
+	Seopt o;
+	Sexp *e, *a;
+	char *in, *tin, *v, buf[64], file[64];
+	vlong t, x;
+	uint n;
+	int i, fd;
+
+	n = 3000;
+	in = malloc(n+64);
+	i = snprint(in, 64, "(data [bin]%ud:", n);
+	v = in+i;
+	for(i = 0; i < n; i++)
+		v[i] = i*7;
+	strcpy(v+n, " end)");
+
+	memset(&o, 0, sizeof(o));
+	o.maxatom = 100;	/* big atoms are not held to it */
+	o.bigatom = 1000;
+	o.big = Bigsink;
+	o.sink = sink;
+	o.sinkarg = &t;
+	t = 0;
+	e = se_unpackopt(in, v-in+n+5, nil, &o);
+	check("big", "sink", e != nil && se_asvlong(nth(e, 1), &x) == 0 && x == n && strcmp(se_op(e), "data") == 0);
+	se_free(e);
+	t = -1000000;	/* the sink returns nil */
+	check("big", "sink refuses", se_unpackopt(in, v-in+n+5, nil, &o) == nil);
+
+	o.big = Bigref;
+	e = se_unpackopt(in, v-in+n+5, nil, &o);
+	a = nth(e, 1);
+	check("big", "ref", e != nil && se_atomlen(a) == n && se_atomread(a, buf, 10, n-5) == 5 &&
+		memcmp(buf, v+n-5, 5) == 0 && se_atom(a, nil) != nil && memcmp(se_atom(a, nil), v, n) == 0 &&
+		a->hint != nil && strcmp(s_to_c(a->hint), "bin") == 0);
+	se_free(e);
+	tin = "{KDQ6ZGF0YTIwOmFiY2RlZmdoaWprbG1ub3BxcnN0KQ==}";	/* (4:data20:abcdefghijklmnopqrst) */
+	o.bigatom = 20;
+	check("big", "ref in transport", se_unpackopt(tin, strlen(tin), nil, &o) == nil);
+	o.bigatom = 1000;
+
+	snprint(file, sizeof file, "/tmp/stest.%d", getpid());
+	fd = create(file, ORDWR|ORCLOSE, 0600);
+	o.big = Bigspill;
+	o.spill = fd;
+	e = fd >= 0? se_unpackopt(in, v-in+n+5, nil, &o): nil;
+	a = nth(e, 1);
+	check("big", "spill", e != nil && se_atomlen(a) == n && se_atomread(a, buf, 10, 100) == 10 &&
+		memcmp(buf, v+100, 10) == 0 && memcmp(se_atom(a, nil), v, n) == 0 && seek(fd, 0, 2) == n);
+	se_free(e);
+	if(fd >= 0)
+		close(fd);
+
+	o.big = Bigload;
+	check("big", "load over maxatom", se_unpackopt(in, v-in+n+5, nil, &o) == nil);
+	free(in);
+}
+
+/* a tree of some 20000 nodes, above the size the pool leaves to the serial functions */
+Sexp*
+bigtree(int change)
+{
+	Sexp *e, **l;
+	char buf[128];
+	int i;
+
+	e = se_list(se_str("log"), nil);
+	l = &e->tl;
+	for(i = 0; i < 1000; i++){
+		snprint(buf, sizeof buf, "(rec %d (a b c) (d (e %d)) f)", i, i == 500? change: i);
+		*l = se_cons(parse(buf), nil);
+		l = &(*l)->tl;
+	}
+	return e;
+}
+
+void
+pool(void)
+{
+	Sepool *p;
+	Sexp *a, *b, *c, *d;
+	uint h;
+
+	p = se_poolopen(4);
+	check("pool", "open", p != nil);
+	if(p == nil)
+		return;
+	a = bigtree(500);
+	b = bigtree(500);
+	d = bigtree(-1);
+	h = se_hash(b);
+	check("pool", "peq", se_peq(p, a, b) && !se_peq(p, a, d));
+	c = se_pcopy(p, a);
+	check("pool", "pcopy", c != nil && c != a && se_eq(c, b));
+	check("pool", "phash", se_phash(p, c) == h);
+	se_pfree(p, c);
+	se_pfree(p, d);
+	c = bigtree(500);	/* reuses the nodes just freed */
+	check("pool", "pfree", se_eq(a, b) && se_eq(c, b));
+	se_free(a);
+	se_free(b);
+	se_free(c);
+	se_poolclose(p);
+}
 
 void
 main(int argc, char **argv)
 {
 	char *s, *es;
-	Sexp *e, *e64;
-	String *b64;
+	Sexp *e, *e64, *et;
+	String *b64, *t;
+	uchar *a;
+	uint n;
 
 	ARGBEGIN{
 	}ARGEND
@@ -33,11 +1358,45 @@ main(int argc, char **argv)
 			print("	equal\n");
 		else
 			print("	not equal\n");
+		t = se_text(e);
+		et = se_parse(s_to_c(t), nil);
+		if(se_eq(e, et))
+			print("	text equal\n");
+		else
+			print("	text not equal\n");
+		se_free(et);
+		s_free(t);
+		n = se_packedsize(e);
+		a = malloc(n);
+		se_pack(a, n, e);
+		if(fedeq(e, s, strlen(s)) && fedeq(e, (char*)a, n) && fedeq(e, s_to_c(b64), s_len(b64)))
+			print("	fed equal\n");
+		else
+			print("	fed not equal\n");
+		free(a);
 		s_free(b64);
 		se_free(e64);
 		se_free(e);
 	}
 	e = se_form("a", se_form("b", se_form("c", nil), se_str("239329"), nil), se_list(nil), nil);
 	print("-> %s\n", s_to_c(se_text(e)));
-	exits(nil);
+	transports();
+	numbers();
+	diffs();
+	matches();
+	traversal();
+	builds();
+	compacts();
+	packcaches();
+	packvs();
+	caches();
+	scans();
+	snapshots();
+	colls();
+	dispatches();
+	batches();
+	limits();
+	bigatoms();
+	pool();
+	exits(nfail? "fail": nil);
 }